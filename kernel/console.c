@@ -20,6 +20,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
+#include "poll.h"
 #include "proc.h"
 
 #define BACKSPACE 0x100
@@ -58,13 +59,17 @@ struct {
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
-
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  char buf[64];
+  int i, j, m;
+
+  for(i = 0; i < n; i += m){
+    m = n - i;
+    if(m > sizeof(buf))
+      m = sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    uartputc(c);
+    for(j = 0; j < m; j++)
+      uartputc(buf[j]);
   }
 
   return i;
@@ -108,9 +113,15 @@ consoleread(int user_dst, uint64 dst, int n)
     }
 
     // copy the input byte to the user-space buffer.
+    // don't hold cons.lock, since faulting in the
+    // user page may sleep.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
+    release(&cons.lock);
+    if(either_copyout(user_dst, dst, &cbuf, 1) == -1){
+      acquire(&cons.lock);
       break;
+    }
+    acquire(&cons.lock);
 
     dst++;
     --n;
@@ -126,6 +137,20 @@ consoleread(int user_dst, uint64 dst, int n)
   return target - n;
 }
 
+// poll() events console I/O could do now without blocking:
+// reads wait for a whole line, writes never wait.
+int
+consoleready(int events)
+{
+  int r = events & POLLOUT;
+
+  acquire(&cons.lock);
+  if(cons.r != cons.w)
+    r |= events & POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 //
 // the console input interrupt handler.
 // uartintr() calls this for input character.
@@ -170,6 +195,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwakeup();
       }
     }
     break;
@@ -189,4 +215,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].ready = consoleready;
 }
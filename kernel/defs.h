@@ -1,17 +1,26 @@
 struct buf;
 struct context;
 struct file;
+struct faultstat;
 struct inode;
+struct meminfo;
+struct kthread;
 struct pipe;
+struct pollfd;
+struct procmem;
 struct proc;
+struct shm;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
+struct vmstat;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bnew(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
@@ -23,6 +32,7 @@ void            consoleintr(int);
 void            consputc(int);
 
 // exec.c
+extern int      lazyexec;
 int             exec(char*, char**);
 
 // file.c
@@ -33,6 +43,9 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             fileready(struct file*, int);
+int             filepoll(struct pollfd*, int, int);
+void            pollwakeup(void);
 
 // fs.c
 void            fsinit(int);
@@ -63,6 +76,13 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            krefinc(void *);
+int             krefcount(void *);
+void*           ksuperalloc(void);
+void            ksuperfree(void *);
+int             kfreepages(void);
+void            kfreebatch(void **, int);
+void            kmeminfo(struct meminfo*);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -75,6 +95,8 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipeready(struct pipe*, int);
+extern int      npipes;
 
 // printf.c
 void            printf(char*, ...);
@@ -101,12 +123,20 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kproc(char*, void (*)(void));
+void            meminfo(struct meminfo*);
+int             faultstat(int, uint64);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeupkt(struct kthread*, void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            switchuvm(struct proc*);
+void            asidflush(struct proc*, uint64);
+void            asidflushall(struct proc*);
+void            asidretire(struct proc*);
 int             kthread_create( void *(*start_func)(), void *stack, uint stack_size );
 int             kthread_id(); 
 int             kthread_kill(int ktid); 
@@ -121,6 +151,8 @@ int                 alloctid();
 struct kthread *    alloc_kthread(struct proc *p);
 void                free_kthread(struct kthread *kt);
 struct trapframe    *get_kthread_trapframe(struct proc *p, struct kthread *kt);
+int                 kthreadlockall(struct proc *p);
+void                kthreadunlockall(struct proc *p);
 int             kthread_killed(struct kthread *kt);
 
 
@@ -130,6 +162,38 @@ void allocproc_help_function(struct proc *p);
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// copyuser.S
+int             copyuser(void*, void*, uint64);
+int             copyuserstr(char*, char*, uint64);
+extern char     copyuser_start[], copyuser_end[], copyuser_fault[];
+
+// shm.c
+void            shminit(void);
+int             shmget(int, uint64);
+struct shm*     shmattach(int);
+struct shm*     shmanon(uint64);
+struct shm*     shmfile(struct inode*);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+void            shmexit(int);
+uint64          shmpage(struct shm*, uint64);
+uint64          shmset(struct shm*, uint64, char*);
+uint64          shmfilepage(struct inode*, uint64);
+uint64          shmsize(struct shm*);
+
+// lz.c
+#define LZTABLE 1024    // entries in lzcompress()'s hash table
+int             lzcompress(uchar*, int, uchar*, int, ushort*);
+int             lzdecompress(uchar*, int, uchar*, int);
+
+// swap.c
+void            swapinit(void);
+void            swapdup(int);
+void            swapput(int);
+int             swapin(struct proc*, uint64);
+int             reclaim(int);
+int             reclaimlow(void);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -167,6 +231,7 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            alarmupcall(struct kthread*);
 
 // uart.c
 void            uartinit(void);
@@ -178,21 +243,46 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+void            kvmswitch(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
+pagetable_t     kvmcreate(pagetable_t);
+void            kvmuser(pagetable_t, pagetable_t);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
+uint64          uvmuntouched(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
+void            uvmcount(pagetable_t, struct procmem*);
+uint64          kvmcount(void);
+void            reapinit(void);
+void            uvmfreelater(pagetable_t, uint64);
+int             uvmreapwait(void);
+void            uvmreaper(void);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
+int             uvmsplit(pagetable_t, uint64);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walkleaf(pagetable_t, uint64, int *);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             copyout_nofault(pagetable_t, uint64, char *, uint64);
+int             copyin_nofault(pagetable_t, char *, uint64, uint64);
+int             uvmfault(struct proc *, uint64, int);
+uint64          vmafloor(struct proc *);
+void            vmaunmap(struct proc *, struct vma *, uint64, uint64);
+void            vmaunmapall(struct proc *);
+int             vmacopy(struct proc *, struct proc *);
+extern struct vmstat vmstat;
+extern int      superpages;
+extern struct faultstat faults;
+extern struct spinlock faultlock;
+extern int      faultlog;
+extern char     *zeropage;
 
 // plic.c
 void            plicinit(void);
@@ -203,7 +293,15 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+uint64          virtio_disk_size(void);
 void            virtio_disk_intr(void);
 
+// zram.c
+void            zraminit(void);
+int             zramstore(int, char*);
+int             zramload(int, char*);
+void            zramfree(int);
+extern int      zram;
+
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
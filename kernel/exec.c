@@ -6,9 +6,15 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "vmstat.h"
 
 static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
 
+// if set, exec() records each PT_LOAD segment and lets
+// uvmfault() read its pages from the executable on first
+// touch, instead of loading the whole image up front.
+int lazyexec = 1;
+
 int flags2perm(int flags)
 {
     int perm = 0;
@@ -30,6 +36,9 @@ int exec(char *path, char **argv)
     pagetable_t pagetable = 0, oldpagetable;
     struct proc *p = myproc();
     struct kthread *kt = mykthread();
+    struct execseg segs[NEXECSEG];
+    struct inode *segip = 0, *oldip;
+    int nseg = 0, lazy = lazyexec;
 
     begin_op();
 
@@ -61,8 +70,25 @@ int exec(char *path, char **argv)
             goto bad;
         if (ph.vaddr + ph.memsz < ph.vaddr)
             goto bad;
+        // leave room for the stack below the devices.
+        if (ph.vaddr + ph.memsz > DEVBASE - 2 * PGSIZE)
+            goto bad;
         if (ph.vaddr % PGSIZE != 0)
             goto bad;
+        if (lazy)
+        {
+            // leave the segment to be paged in by uvmfault().
+            if (nseg >= NEXECSEG || ph.vaddr < PGROUNDUP(sz))
+                goto bad;
+            segs[nseg].vaddr = ph.vaddr;
+            segs[nseg].memsz = ph.memsz;
+            segs[nseg].filesz = ph.filesz;
+            segs[nseg].off = ph.off;
+            segs[nseg].perm = flags2perm(ph.flags);
+            nseg++;
+            sz = ph.vaddr + ph.memsz;
+            continue;
+        }
         uint64 sz1;
         if ((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
             goto bad;
@@ -70,6 +96,8 @@ int exec(char *path, char **argv)
         if (loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
             goto bad;
     }
+    if (nseg > 0)
+        segip = idup(ip);
     iunlockput(ip);
     end_op();
     ip = 0;
@@ -133,6 +161,9 @@ int exec(char *path, char **argv)
             kthread_join(kt2->tid, 0);
         }
     }
+    // mmap() regions don't survive into the new image.
+    vmaunmapall(p);
+
     // arguments to user main(argc, argv)
     // argc is returned via the system call return
     // value, which goes in a0.
@@ -146,11 +177,29 @@ int exec(char *path, char **argv)
 
     // Commit to the user image.
     oldpagetable = p->pagetable;
+    oldip = p->execip;
+    acquire(&p->vm_lock);
     p->pagetable = pagetable;
+    kvmuser(p->kpagetable, pagetable);
+    asidflushall(p);
     p->sz = sz;
+    p->execip = segip;
+    memmove(p->execseg, segs, sizeof(segs));
+    p->nexecseg = nseg;
+    release(&p->vm_lock);
     kt->trapframe->epc = elf.entry; // initial program counter = main
     kt->trapframe->sp = sp;         // initial stack pointer
+    kt->trapframe->tp = 0;          // no thread pointer yet
+    kt->alarmticks = 0;             // the handler is gone
     proc_freepagetable(oldpagetable, oldsz);
+    if (oldip)
+    {
+        begin_op();
+        iput(oldip);
+        end_op();
+    }
+    for (i = 0; i < nseg; i++)
+        __sync_fetch_and_add(&vmstat.exec_pages, PGROUNDUP(segs[i].memsz) / PGSIZE);
 
     return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -162,6 +211,12 @@ bad:
         iunlockput(ip);
         end_op();
     }
+    if (segip)
+    {
+        begin_op();
+        iput(segip);
+        end_op();
+    }
     return -1;
 }
 
@@ -0,0 +1,34 @@
+// Page fault counters, returned by the faultstat() system call.
+
+// kinds of fault.
+#define FAULT_MINOR 0   // page was there: only a TLB or permission fix,
+                        // or a sibling kthread faulted it in first
+#define FAULT_ZERO  1   // zero-filled page or the zero page mapped
+#define FAULT_COW   2   // copy-on-write page copied
+#define FAULT_FILE  3   // page read from the executable or a mapped file
+#define FAULT_SWAP  4   // page read back from swap
+#define FAULT_BAD   5   // bad address, or out of memory
+                        // (NFAULT in param.h counts the kinds)
+
+#define NFAULTHIST 16   // latency buckets, by powers of two
+#define NFAULTLOG  64   // recent faults logged
+
+// one logged fault.
+struct faultrec {
+  int pid;
+  int kind;
+  uint64 va;        // faulting address
+  uint64 epc;       // user pc of the access, or of the system call
+  uint64 time;      // timer cycles it took
+};
+
+struct faultstat {
+  uint64 count[NFAULT];
+  // faults of each kind taking [2^i, 2^(i+1)) timer cycles;
+  // the last bucket holds anything slower.
+  uint64 hist[NFAULT][NFAULTHIST];
+  // the last NFAULTLOG faults, with log[nlog % NFAULTLOG]
+  // next to be written, if vmtune(VM_FAULTLOG) turned it on.
+  uint64 nlog;
+  struct faultrec log[NFAULTLOG];
+};
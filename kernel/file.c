@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -19,10 +20,19 @@ struct {
   struct file file[NFILE];
 } ftable;
 
+// poll() sleeps on pollq.gen until a file may have become
+// ready, which pollwakeup() marks by bumping it.
+struct {
+  struct spinlock lock;
+  uint gen;
+  int sleepers;
+} pollq;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  initlock(&pollq.lock, "poll");
 }
 
 // Allocate a file structure.
@@ -180,3 +190,78 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+
+// Which of events (POLLIN, POLLOUT) I/O on f could do now
+// without blocking.
+int
+fileready(struct file *f, int events)
+{
+  if(!f->readable)
+    events &= ~POLLIN;
+  if(!f->writable)
+    events &= ~POLLOUT;
+  if(f->type == FD_PIPE)
+    return pipeready(f->pipe, events);
+  if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV && devsw[f->major].ready)
+    return devsw[f->major].ready(events);
+  return events;  // inodes and other devices don't block.
+}
+
+// Wait until one of the n files in fds is ready for the
+// events asked for, or for timeout ticks if timeout isn't
+// negative. Sets each revents, and returns how many are
+// ready, or -1 if killed.
+int
+filepoll(struct pollfd *fds, int n, int timeout)
+{
+  struct proc *p = myproc();
+  struct file *f;
+  uint gen, ticks0 = ticks;
+  int i, ready;
+
+  for(;;){
+    acquire(&pollq.lock);
+    pollq.sleepers++;
+    gen = pollq.gen;
+    release(&pollq.lock);
+
+    ready = 0;
+    for(i = 0; i < n; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if(fds[i].fd >= NOFILE || (f = p->ofile[fds[i].fd]) == 0)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = fileready(f, fds[i].events);
+      if(fds[i].revents)
+        ready++;
+    }
+
+    acquire(&pollq.lock);
+    if(ready || timeout == 0 || (timeout > 0 && ticks - ticks0 >= timeout) || killed(p)){
+      pollq.sleepers--;
+      release(&pollq.lock);
+      return killed(p) ? -1 : ready;
+    }
+    // something may have become ready while we looked.
+    if(pollq.gen == gen)
+      sleep(&pollq.gen, &pollq.lock);
+    pollq.sleepers--;
+    release(&pollq.lock);
+  }
+}
+
+// A file may have become ready: wake poll()ers to look.
+// Called on each clock tick too, for their timeouts.
+void
+pollwakeup(void)
+{
+  __sync_synchronize();
+  if(pollq.sleepers == 0)
+    return;
+  acquire(&pollq.lock);
+  pollq.gen++;
+  wakeup(&pollq.gen);
+  release(&pollq.lock);
+}
@@ -18,6 +18,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct shm *mmap;   // MAP_SHARED pages, under shmtab.lock; see shm.c
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -33,6 +34,7 @@ struct inode {
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*ready)(int);    // poll() events that won't block, or 0 if none do
 };
 
 extern struct devsw devsw[];
@@ -473,6 +473,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  uint64 pa;
+  int r;
 
   if(off > ip->size || off + n < off)
     return 0;
@@ -480,11 +482,21 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    m = min(n - tot, BSIZE - off%BSIZE);
+    // MAP_SHARED mappings' copy of the page may be newer.
+    if(ip->mmap && (pa = shmfilepage(ip, off / PGSIZE)) != 0){
+      r = either_copyout(user_dst, dst, (char*)pa + off % PGSIZE, m);
+      kfree((void*)pa);
+      if(r == -1){
+        tot = -1;
+        break;
+      }
+      continue;
+    }
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
     bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
       tot = -1;
@@ -507,6 +519,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  uint64 pa;
 
   if(off > ip->size || off + n < off)
     return -1;
@@ -523,6 +536,11 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    // keep MAP_SHARED mappings' copy of the page up to date.
+    if(ip->mmap && (pa = shmfilepage(ip, off / PGSIZE)) != 0){
+      memmove((char*)pa + off % PGSIZE, bp->data + (off % BSIZE), m);
+      kfree((void*)pa);
+    }
     log_write(bp);
     brelse(bp);
   }
@@ -1,6 +1,7 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or 2 MB superpages of 512 contiguous free pages.
 
 #include "types.h"
 #include "param.h"
@@ -8,21 +9,65 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "meminfo.h"
 
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// free pages are doubly linked, so that ksuperalloc() can
+// take all those of one superpage off the list.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
+// index of the physical page at pa in kmem.ref[].
+#define PAGEIDX(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+// index of the superpage holding pa in kmem.nfree[].
+#define SUPERIDX(pa) (((uint64)(pa) - KERNBASE) / SUPERPGSIZE)
+
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int npages;   // pages on the free list
+  int total;    // pages kalloc() manages
+  // number of free pages in each superpage.
+  int nfree[(PHYSTOP - KERNBASE) / SUPERPGSIZE];
+  // number of page tables (or other owners) referring to
+  // each page, so that mappings shared by fork() are freed
+  // by the last kfree().
+  int ref[(PHYSTOP - KERNBASE) / PGSIZE];
 } kmem;
 
+// Put free page r on the free list. Caller holds kmem.lock.
+static void
+push(struct run *r)
+{
+  r->prev = 0;
+  r->next = kmem.freelist;
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist = r;
+  kmem.nfree[SUPERIDX(r)]++;
+  kmem.npages++;
+}
+
+// Take free page r off the free list. Caller holds kmem.lock.
+static void
+unlink(struct run *r)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree[SUPERIDX(r)]--;
+  kmem.npages--;
+}
+
 void
 kinit()
 {
@@ -35,33 +80,97 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kmem.ref[PAGEIDX(p)] = 1;
     kfree(p);
+    kmem.total++;
+  }
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by pa, and free it if that was the last one. pa
+// normally should have been returned by a call to kalloc().
+// (The exception is when initializing the allocator; see
+// kinit above.)
 void
 kfree(void *pa)
 {
   struct run *r;
+  int ref;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  acquire(&kmem.lock);
+  ref = --kmem.ref[PAGEIDX(pa)];
+  release(&kmem.lock);
+  if(ref < 0)
+    panic("kfree: ref");
+  if(ref > 0)
+    return;
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  push(r);
+  release(&kmem.lock);
+}
+
+// kfree() the n pages in pa[], taking kmem.lock twice in
+// all rather than twice for each. Reuses pa[].
+void
+kfreebatch(void **pa, int n)
+{
+  int i, k = 0, ref;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < n; i++){
+    if(((uint64)pa[i] % PGSIZE) != 0 || (char*)pa[i] < end || (uint64)pa[i] >= PHYSTOP)
+      panic("kfreebatch");
+    if((ref = --kmem.ref[PAGEIDX(pa[i])]) < 0)
+      panic("kfreebatch: ref");
+    if(ref == 0)
+      pa[k++] = pa[i];
+  }
+  release(&kmem.lock);
+
+  for(i = 0; i < k; i++)
+    memset(pa[i], 1, PGSIZE);
+
+  acquire(&kmem.lock);
+  for(i = 0; i < k; i++)
+    push((struct run*)pa[i]);
+  release(&kmem.lock);
+}
+
+// Add a reference to a page returned by kalloc(),
+// for a mapping shared between page tables.
+void
+krefinc(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("krefinc");
+
+  acquire(&kmem.lock);
+  kmem.ref[PAGEIDX(pa)]++;
   release(&kmem.lock);
 }
 
+// Return the number of references to page pa.
+int
+krefcount(void *pa)
+{
+  int ref;
+
+  acquire(&kmem.lock);
+  ref = kmem.ref[PAGEIDX(pa)];
+  release(&kmem.lock);
+  return ref;
+}
+
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
@@ -72,11 +181,83 @@ kalloc(void)
 
   acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  if(r){
+    unlink(r);
+    kmem.ref[PAGEIDX(r)] = 1;
+  }
   release(&kmem.lock);
 
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
   return (void*)r;
 }
+
+// Return the number of free pages.
+int
+kfreepages(void)
+{
+  return kmem.npages;
+}
+
+// Fill in the allocator's part of mi, for meminfo().
+void
+kmeminfo(struct meminfo *mi)
+{
+  acquire(&kmem.lock);
+  mi->total = kmem.total;
+  mi->free = kmem.npages;
+  release(&kmem.lock);
+  mi->kernel = (PGROUNDUP((uint64)end) - KERNBASE) / PGSIZE;
+}
+
+// Allocate a 2 MB superpage: 512 physically contiguous,
+// 2 MB-aligned pages. Each page gets a reference of its own,
+// so a superpage that is later split into 4 KB mappings can
+// be freed a page at a time with kfree().
+// Returns 0 if no superpage is entirely free.
+void *
+ksuperalloc(void)
+{
+  char *pa = 0;
+  int i, n;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < NELEM(kmem.nfree); i++){
+    if(kmem.nfree[i] == SUPERPGSIZE / PGSIZE){
+      pa = (char*)KERNBASE + (uint64)i * SUPERPGSIZE;
+      break;
+    }
+  }
+  if(pa){
+    for(n = 0; n < SUPERPGSIZE / PGSIZE; n++){
+      unlink((struct run*)(pa + n*PGSIZE));
+      kmem.ref[PAGEIDX(pa + n*PGSIZE)] = 1;
+    }
+  }
+  release(&kmem.lock);
+
+  if(pa)
+    memset(pa, 5, SUPERPGSIZE); // fill with junk
+  return pa;
+}
+
+// Free a superpage returned by ksuperalloc() whose pages
+// each have a single reference.
+void
+ksuperfree(void *pa)
+{
+  char *p;
+
+  if(((uint64)pa % SUPERPGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("ksuperfree");
+
+  memset(pa, 1, SUPERPGSIZE);
+  acquire(&kmem.lock);
+  for(p = pa; p < (char*)pa + SUPERPGSIZE; p += PGSIZE){
+    if(kmem.ref[PAGEIDX(p)] != 1)
+      panic("ksuperfree: ref");
+    kmem.ref[PAGEIDX(p)] = 0;
+    push((struct run*)p);
+  }
+  release(&kmem.lock);
+}
@@ -68,6 +68,9 @@ alloc_kthread(struct proc *p)
 found:
     kt->tid = alloctid(p);
     kt->state = USED;
+    kt->cpu = -1;
+    kt->kpreempted = 0;
+    kt->alarmticks = 0;
     kt->trapframe = get_kthread_trapframe(p, kt);
     kt->my_pcb = p;
 
@@ -103,6 +106,39 @@ struct trapframe *get_kthread_trapframe(struct proc *p, struct kthread *kt)
     return p->base_trapframes + ((int)(kt - p->kthread));
 }
 
+// Acquire the locks of all of p's kthreads, so that none of
+// them can start running, and return 1 if none is running
+// now but the caller, or was preempted in the kernel (where
+// it may be between looking up a user page and using it).
+// Otherwise release them and return 0.
+int kthreadlockall(struct proc *p)
+{
+    struct kthread *me = mykthread();
+    int i, j;
+
+    for (i = 0; i < NKT; i++)
+    {
+        acquire(&p->kthread[i].lock);
+        if (&p->kthread[i] != me &&
+            (p->kthread[i].state == RUNNING ||
+             (p->kthread[i].state == RUNNABLE && p->kthread[i].kpreempted)))
+        {
+            for (j = i; j >= 0; j--)
+                release(&p->kthread[j].lock);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void kthreadunlockall(struct proc *p)
+{
+    int i;
+
+    for (i = NKT - 1; i >= 0; i--)
+        release(&p->kthread[i].lock);
+}
+
 int kthread_killed(struct kthread *kt)
 {
     int k;
@@ -77,6 +77,8 @@ struct cpu
     struct context context; // swtch() here to enter scheduler().
     int noff;               // Depth of push_off() nesting.
     int intena;             // Were interrupts enabled before push_off()?
+    uint64 asidgen;         // ASID generation the TLB has been flushed for.
+    pagetable_t kpagetable; // Process kernel page table installed, or 0.
 };
 
 extern struct cpu cpus[NCPU];
@@ -100,6 +102,11 @@ struct kthread
     int xstate;           // Exit status to be returned to parent's wait
     int tid;              // Process ID
     struct proc* my_pcb;
+    int cpu;              // Hart it last ran on, or -1
+    int kpreempted;       // Gave up the CPU in kerneltrap(), maybe mid-copy
+    int alarmticks;       // sigalarm() interval in ticks, or 0
+    int alarmleft;        // ticks until the next upcall
+    uint64 alarmhandler;  // user address of the upcall
     uint64 kstack; // Virtual address of kernel stack
 
     struct trapframe *trapframe;
@@ -0,0 +1,154 @@
+// A small LZ77 compressor, in the manner of LZ4, for
+// compressed swap (see zram.c).
+//
+// Compressed data is a series of sequences, each a token
+// byte followed by a run of literal bytes to copy, then the
+// 2-byte little-endian offset back into the output of a
+// match to repeat. The token's high 4 bits are the literal
+// count and its low 4 bits the match length less MINMATCH;
+// either nibble at 15 continues in bytes that follow (255
+// means more to come). The last sequence has literals only.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define MINMATCH 4
+#define HASHSHIFT (32 - 10)   // LZTABLE is 1 << 10
+
+static uint
+read32(uchar *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint)p[3] << 24);
+}
+
+// Append the rest of a length whose token nibble was 15.
+// Returns the new end of output, or 0 if it would pass oend.
+static uchar*
+putlen(uchar *op, uchar *oend, int len)
+{
+  for(; len >= 255; len -= 255){
+    if(op >= oend)
+      return 0;
+    *op++ = 255;
+  }
+  if(op >= oend)
+    return 0;
+  *op++ = len;
+  return op;
+}
+
+// Append a sequence of nlit literals from lit and, if mlen
+// isn't 0, a match of mlen bytes off back. Returns the new
+// end of output, or 0 if it would pass oend.
+static uchar*
+emit(uchar *op, uchar *oend, uchar *lit, int nlit, int off, int mlen)
+{
+  uchar *tok;
+
+  if(op >= oend)
+    return 0;
+  tok = op++;
+  *tok = (nlit < 15 ? nlit : 15) << 4;
+  if(nlit >= 15 && (op = putlen(op, oend, nlit - 15)) == 0)
+    return 0;
+  if(nlit > oend - op)
+    return 0;
+  memmove(op, lit, nlit);
+  op += nlit;
+  if(mlen == 0)
+    return op;
+
+  if(oend - op < 2)
+    return 0;
+  *op++ = off;
+  *op++ = off >> 8;
+  mlen -= MINMATCH;
+  *tok |= mlen < 15 ? mlen : 15;
+  if(mlen >= 15 && (op = putlen(op, oend, mlen - 15)) == 0)
+    return 0;
+  return op;
+}
+
+// Compress n (at most 65535) bytes at src into dst, using
+// table, of LZTABLE entries, to find matches. Returns the
+// compressed length, or -1 if it would be more than max.
+int
+lzcompress(uchar *src, int n, uchar *dst, int max, ushort *table)
+{
+  uchar *ip = src, *anchor = src, *end = src + n;
+  uchar *op = dst, *oend = dst + max;
+  uchar *ref;
+  uint h;
+  int mlen;
+
+  memset(table, 0xff, LZTABLE * sizeof(table[0]));
+  while(ip + MINMATCH <= end){
+    h = (read32(ip) * 2654435761U) >> HASHSHIFT;
+    ref = table[h] == 0xffff ? 0 : src + table[h];
+    table[h] = ip - src;
+    if(ref == 0 || read32(ref) != read32(ip)){
+      ip++;
+      continue;
+    }
+    for(mlen = MINMATCH; ip + mlen < end && ref[mlen] == ip[mlen]; mlen++)
+      ;
+    if((op = emit(op, oend, anchor, ip - anchor, ip - ref, mlen)) == 0)
+      return -1;
+    ip += mlen;
+    anchor = ip;
+  }
+  if(anchor < end && (op = emit(op, oend, anchor, end - anchor, 0, 0)) == 0)
+    return -1;
+  return op - dst;
+}
+
+// Decompress n bytes at src into dst, which has room for
+// max. Returns the decompressed length, or -1 if src is
+// corrupt or decompresses to more than max.
+int
+lzdecompress(uchar *src, int n, uchar *dst, int max)
+{
+  uchar *ip = src, *iend = src + n;
+  uchar *op = dst, *oend = dst + max;
+  uchar *ref;
+  int token, len, off, b;
+
+  while(ip < iend){
+    token = *ip++;
+    len = token >> 4;
+    if(len == 15){
+      do {
+        if(ip >= iend)
+          return -1;
+        len += (b = *ip++);
+      } while(b == 255);
+    }
+    if(len > iend - ip || len > oend - op)
+      return -1;
+    memmove(op, ip, len);
+    op += len;
+    ip += len;
+    if(ip == iend)
+      break;  // the last sequence.
+
+    if(iend - ip < 2)
+      return -1;
+    off = ip[0] | (ip[1] << 8);
+    ip += 2;
+    len = (token & 15) + MINMATCH;
+    if((token & 15) == 15){
+      do {
+        if(ip >= iend)
+          return -1;
+        len += (b = *ip++);
+      } while(b == 255);
+    }
+    if(off == 0 || off > op - dst || len > oend - op)
+      return -1;
+    // byte at a time: the match may overlap what it makes.
+    for(ref = op - off; len > 0; len--)
+      *op++ = *ref++;
+  }
+  return op - dst;
+}
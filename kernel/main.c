@@ -27,8 +27,11 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    shminit();       // shared memory objects
+    reapinit();      // freeing of exited address spaces
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
+    kproc("reaper", uvmreaper);
     __sync_synchronize();
     started = 1;
   } else {
@@ -0,0 +1,24 @@
+// Physical memory usage, returned by the meminfo() system
+// call. All counts are in pages.
+
+// one process's memory.
+struct procmem {
+  int pid;
+  char name[16];
+  uint64 rss;       // user pages mapped, counting shared ones
+  uint64 swapped;   // user pages in swap
+  uint64 ptpages;   // page-table pages, user and kernel
+};
+
+struct meminfo {
+  uint64 total;       // pages kalloc() hands out
+  uint64 free;        // of those, free now
+  uint64 kernel;      // kernel code and data, outside kalloc()
+  uint64 pagetables;  // page-table pages, the kernel's and processes'
+  uint64 trapframes;  // processes' trapframe pages
+  uint64 kstacks;     // kernel stacks
+  uint64 pipes;       // pipe buffers
+  uint64 zram;        // compressed swap pool
+  int nproc;          // entries of proc[] in use
+  struct procmem proc[NPROC];
+};
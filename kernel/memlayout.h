@@ -41,6 +41,14 @@
 #define PLIC_MCLAIM(hart) (PLIC + 0x200004 + (hart)*0x2000)
 #define PLIC_SCLAIM(hart) (PLIC + 0x201004 + (hart)*0x2000)
 
+// every user page table shares the kernel's mappings of the
+// devices above (without PTE_U), so that a process's kernel
+// page table can use the user's first level-1 page-table page
+// as its own. user memory must stay out of [DEVBASE, DEVTOP),
+// and the kernel reaches user memory below DEVBASE directly.
+#define DEVBASE PLIC
+#define DEVTOP (UART0 + 0x200000L)
+
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
 // from physical address 0x80000000 to PHYSTOP.
@@ -60,8 +68,15 @@
 //   text
 //   original data and bss
 //   fixed-size stack
-//   expandable heap
+//   expandable heap, up to DEVBASE
+//   ...
+//   mmap() regions, allocated downwards from MMAPTOP
 //   ...
 //   TRAPFRAME (kt->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
+
+// mmap() regions stay below the kernel stacks' addresses,
+// and out of [KERNBASE, PHYSTOP), so no user mapping aliases
+// one of the kernel's under the process's ASID.
+#define MMAPTOP KSTACK(NPROC*NKT)
 #define TRAPFRAME(kt_idx) (TRAMPOLINE - PGSIZE + (kt_idx * sizeof(struct trapframe)))
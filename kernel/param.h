@@ -7,8 +7,16 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NEXECSEG      4  // max demand-paged ELF segments per process
+#define NVMA         16  // max mmap() regions per process
+#define NSHM         32  // max shared memory objects per system
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
+#define NSWAP        8192  // max swap slots (pages) after the file system
+#define NZPOOL       4096  // max pages holding compressed swap
+#define REAPBATCH    64    // pages the reaper frees at a time
+#define NFAULT       6     // kinds of page fault; see fault.h
+#define SWAPBATCH    32    // max pages reclaim() evicts in one pass
 #define MAXPATH      128   // maximum file path name
@@ -7,6 +7,10 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+
+// pipe buffers allocated, for meminfo().
+int npipes;
 
 #define PIPESIZE 512
 
@@ -30,6 +34,7 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  __sync_fetch_and_add(&npipes, 1);
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
@@ -46,8 +51,10 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
+  if(pi){
     kfree((char*)pi);
+    __sync_fetch_and_sub(&npipes, 1);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,35 +76,102 @@ pipeclose(struct pipe *pi, int writable)
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
     kfree((char*)pi);
-  } else
+    __sync_fetch_and_sub(&npipes, 1);
+  } else {
     release(&pi->lock);
+    pollwakeup();
+  }
+}
+
+// Which of events a read or write of pi could do now
+// without blocking.
+int
+pipeready(struct pipe *pi, int events)
+{
+  int r = 0;
+
+  acquire(&pi->lock);
+  if((events & POLLIN) && (pi->nread != pi->nwrite || !pi->writeopen))
+    r |= POLLIN;
+  if((events & POLLOUT) && (pi->nread + PIPESIZE - pi->nwrite >= PIPE_BUF || !pi->readopen))
+    r |= POLLOUT;
+  release(&pi->lock);
+  return r;
+}
+
+// user memory is copied straight to or from pi->data when
+// that needn't fault in a page. otherwise it goes through a
+// small buffer on the kernel stack, so that pi->lock is never
+// held while copyin() or copyout() may need to sleep.
+#define PIPECHUNK 128
+
+// bytes that can be copied to or from pi->data at off in one
+// piece: no more than want or avail, and not past the end.
+static int
+span(uint off, int want, uint avail)
+{
+  if(want > avail)
+    want = avail;
+  if(want > PIPESIZE - off)
+    want = PIPESIZE - off;
+  return want;
 }
 
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, j, m;
+  uint off;
   struct proc *pr = myproc();
+  char buf[PIPECHUNK];
 
-  acquire(&pi->lock);
   while(i < n){
+    acquire(&pi->lock);
     if(pi->readopen == 0 || killed(pr)){
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+    if(pi->nwrite == pi->nread + PIPESIZE){
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      release(&pi->lock);
+      continue;
+    }
+    off = pi->nwrite % PIPESIZE;
+    m = span(off, n - i, pi->nread + PIPESIZE - pi->nwrite);
+    if(copyin_nofault(pr->pagetable, &pi->data[off], addr + i, m) == 0){
+      pi->nwrite += m;
+      i += m;
+      wakeup(&pi->nread);
+      release(&pi->lock);
+      pollwakeup();
+      continue;
     }
+    release(&pi->lock);
+
+    m = n - i;
+    if(m > PIPECHUNK)
+      m = PIPECHUNK;
+    if(copyin(pr->pagetable, buf, addr + i, m) == -1)
+      break;
+    acquire(&pi->lock);
+    for(j = 0; j < m; ){
+      if(pi->readopen == 0 || killed(pr)){
+        release(&pi->lock);
+        return -1;
+      }
+      if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+        wakeup(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
+      } else {
+        pi->data[pi->nwrite++ % PIPESIZE] = buf[j++];
+      }
+    }
+    wakeup(&pi->nread);
+    release(&pi->lock);
+    pollwakeup();
+    i += m;
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
 
   return i;
 }
@@ -105,9 +179,10 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, m;
+  uint off;
   struct proc *pr = myproc();
-  char ch;
+  char buf[PIPECHUNK];
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -117,14 +192,27 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n; ){  //DOC: piperead-copy
+    off = pi->nread % PIPESIZE;
+    m = span(off, n - i, pi->nwrite - pi->nread);
+    if(m == 0)
       break;
+    if(copyout_nofault(pr->pagetable, addr + i, &pi->data[off], m) == 0){
+      pi->nread += m;
+      i += m;
+      continue;
+    }
+    for(m = 0; m < PIPECHUNK && i + m < n && pi->nread != pi->nwrite; m++)
+      buf[m] = pi->data[pi->nread++ % PIPESIZE];
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+    release(&pi->lock);
+    if(copyout(pr->pagetable, addr + i, buf, m) == -1)
+      return i;
+    i += m;
+    acquire(&pi->lock);
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  wakeup(&pi->nwrite);
   release(&pi->lock);
+  pollwakeup();
   return i;
 }
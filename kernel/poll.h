@@ -0,0 +1,14 @@
+// poll(fds, n, timeout): wait until I/O on some of the files
+// fds[0..n-1] can go ahead without blocking.
+struct pollfd {
+  int fd;           // or negative to skip
+  short events;     // what to wait for
+  short revents;    // what poll() found ready
+};
+
+#define POLLIN   0x1    // read() won't block
+#define POLLOUT  0x4    // write() of up to PIPE_BUF bytes won't block
+#define POLLNVAL 0x20   // fd isn't open
+
+#define PIPE_BUF 256
+#define NPOLL    32     // most files one poll() looks at
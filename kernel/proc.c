@@ -5,6 +5,9 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "vmstat.h"
+#include "meminfo.h"
+#include "fault.h"
 int kthead_killed(struct kthread *p);
 
 struct cpu cpus[NCPU];
@@ -27,6 +30,22 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// ASIDs tag TLB entries with the process they belong to, so
+// that switching page tables needn't flush the TLB. A process's
+// user and kernel page tables share its ASID, since they map
+// user memory the same way, and kernel mappings are global.
+// ASIDs are handed out in generations. When they run out, a
+// new generation starts, and each hart flushes its whole TLB
+// before it next uses one; the old generation's ASIDs are
+// never used again. ASID 0 is kernel_pagetable's.
+struct
+{
+    struct spinlock lock;
+    uint64 gen; // current generation, counting from 1
+    int next;   // next ASID to hand out in this generation
+    int max;    // largest ASID the hardware has, or 0 if none
+} asids;
+
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
 // guard page.
@@ -53,9 +72,18 @@ void procinit(void)
 
     initlock(&pid_lock, "nextpid");
     initlock(&wait_lock, "wait_lock");
+    initlock(&asids.lock, "asid");
+    asids.gen = 1;
+    asids.next = 1;
+    // the ASID field keeps only as many bits as the
+    // hardware implements, possibly none.
+    w_satp(r_satp() | MAKE_SATP_ASID(0, SATP_ASID_MASK));
+    asids.max = SATP2ASID(r_satp());
+    kvminithart();
     for (p = proc; p < &proc[NPROC]; p++)
     {
         initlock(&p->lock, "proc");
+        initlock(&p->vm_lock, "vm");
         p->state = UNUSED;
         kthreadinit(p);
     }
@@ -148,6 +176,15 @@ found:
         return 0;
     }
 
+    // The page table the kernel runs on for this process.
+    p->kpagetable = kvmcreate(p->pagetable);
+    if (p->kpagetable == 0)
+    {
+        freeproc(p);
+        release(&p->lock);
+        return 0;
+    }
+
     // TODO: delte this after you are done with task 2.2
     // allocproc_help_function(p);
     alloc_kthread(p);
@@ -160,24 +197,39 @@ found:
 static void
 freeproc(struct proc *p)
 {
-    if (p->base_trapframes)
-        kfree((void *)p->base_trapframes);
-    p->base_trapframes = 0;
-    if (p->pagetable)
-        proc_freepagetable(p->pagetable, p->sz);
-    p->pagetable = 0;
-    p->sz = 0;
+    struct cpu *c;
+
     p->pid = 0;
     p->parent = 0;
     p->name[0] = 0;
     p->killed = 0;
     p->xstate = 0;
+    p->asidgen = 0;
+    memset(p->faults, 0, sizeof(p->faults));
     p->state = UNUSED;
     for (struct kthread *kt = p->kthread; kt < &p->kthread[NKT]; kt++)
     {
         acquire(&kt->lock);
         free_kthread(kt);
     }
+    // the kthread locks above waited for the last kthread to
+    // switch to the scheduler; wait for the scheduler to switch
+    // away from this page table too, since it shares the user
+    // page table's level-1 page, before freeing either.
+    for (c = cpus; c < &cpus[NCPU]; c++)
+        while (p->kpagetable &&
+               __atomic_load_n(&c->kpagetable, __ATOMIC_ACQUIRE) == p->kpagetable)
+            ;
+    if (p->base_trapframes)
+        kfree((void *)p->base_trapframes);
+    p->base_trapframes = 0;
+    if (p->pagetable)
+        proc_freepagetable(p->pagetable, p->sz);
+    p->pagetable = 0;
+    p->sz = 0;
+    if (p->kpagetable)
+        kfree((void *)p->kpagetable);
+    p->kpagetable = 0;
 }
 
 // Create a user page table for a given process, with no user memory,
@@ -195,9 +247,10 @@ proc_pagetable(struct proc *p)
     // map the trampoline code (for system call return)
     // at the highest user virtual address.
     // only the supervisor uses it, on the way
-    // to/from user space, so not PTE_U.
+    // to/from user space, so not PTE_U. global,
+    // like the kernel's own mapping of it.
     if (mappages(pagetable, TRAMPOLINE, PGSIZE,
-                 (uint64)trampoline, PTE_R | PTE_X) < 0)
+                 (uint64)trampoline, PTE_R | PTE_X | PTE_G) < 0)
     {
         uvmfree(pagetable, 0);
         return 0;
@@ -217,12 +270,12 @@ proc_pagetable(struct proc *p)
 }
 
 // Free a process's page table, and free the
-// physical memory it refers to.
+// physical memory it refers to, soon (see uvmfreelater()).
 void proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
     uvmunmap(pagetable, TRAPFRAME(0), 1, 0);
-    uvmfree(pagetable, sz);
+    uvmfreelater(pagetable, sz);
 }
 
 // a user program that calls exec("/init")
@@ -237,6 +290,94 @@ uchar initcode[] = {
     0x74, 0x00, 0x00, 0x24, 0x00, 0x00, 0x00, 0x00,
     0x00, 0x00, 0x00, 0x00};
 
+// Start a process that runs fn() in the kernel, with no
+// user memory. fn() is entered holding its kthread's lock,
+// like forkret(), and must never return.
+void kproc(char *name, void (*fn)(void))
+{
+    struct proc *p;
+
+    if ((p = allocproc()) == 0)
+        panic("kproc");
+    p->kthread[0].context.ra = (uint64)fn;
+    p->kthread[0].state = RUNNABLE;
+    release(&p->kthread[0].lock);
+    safestrcpy(p->name, name, sizeof(p->name));
+    release(&p->lock);
+}
+
+// Fill in mi for the meminfo() system call.
+void meminfo(struct meminfo *mi)
+{
+    struct proc *p;
+    struct procmem *m;
+
+    memset(mi, 0, sizeof(*mi));
+    kmeminfo(mi);
+    mi->pagetables = kvmcount();
+    mi->kstacks = NPROC * NKT;
+    mi->pipes = npipes;
+    mi->zram = vmstat.zram_pool;
+    for (p = proc; p < &proc[NPROC]; p++)
+    {
+        acquire(&p->lock);
+        if (p->state == UNUSED)
+        {
+            release(&p->lock);
+            continue;
+        }
+        if (p->base_trapframes)
+            mi->trapframes++;
+        m = &mi->proc[mi->nproc++];
+        m->pid = p->pid;
+        safestrcpy(m->name, p->name, sizeof(m->name));
+        acquire(&p->vm_lock);
+        if (p->pagetable)
+            uvmcount(p->pagetable, m);
+        release(&p->vm_lock);
+        if (p->kpagetable)
+            m->ptpages++;
+        mi->pagetables += m->ptpages;
+        release(&p->lock);
+    }
+}
+
+// Copy page fault counters to user address addr: p's if pid
+// is that of process p, or the whole system's if pid is 0.
+// Returns 0, or -1 if there's no such process.
+int faultstat(int pid, uint64 addr)
+{
+    struct faultstat *fs;
+    struct proc *p;
+    int r = -1;
+
+    // too big for the kernel stack.
+    if ((fs = (struct faultstat *)kalloc()) == 0)
+        return -1;
+    memset(fs, 0, sizeof(*fs));
+    if (pid == 0)
+    {
+        acquire(&faultlock);
+        *fs = faults;
+        release(&faultlock);
+        r = 0;
+    }
+    for (p = proc; pid != 0 && p < &proc[NPROC]; p++)
+    {
+        acquire(&p->lock);
+        if (p->state != UNUSED && p->pid == pid)
+        {
+            memmove(fs->count, p->faults, sizeof(fs->count));
+            r = 0;
+        }
+        release(&p->lock);
+    }
+    if (r == 0)
+        r = copyout(myproc()->pagetable, addr, (char *)fs, sizeof(*fs));
+    kfree(fs);
+    return r;
+}
+
 // Set up first user process.
 void userinit(void)
 {
@@ -264,25 +405,47 @@ void userinit(void)
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only reserves the address space; pages are
+// allocated on first touch by uvmfault().
 // Return 0 on success, -1 on failure.
 int growproc(int n)
 {
     uint64 sz;
     struct proc *p = myproc();
 
+    acquire(&p->vm_lock);
     sz = p->sz;
     if (n > 0)
     {
-        if ((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0)
+        if (sz + n < sz || sz + n > vmafloor(p))
         {
+            release(&p->vm_lock);
             return -1;
         }
+        __sync_fetch_and_add(&vmstat.lazy_pages, (PGROUNDUP(sz + n) - PGROUNDUP(sz)) / PGSIZE);
+        sz += n;
     }
     else if (n < 0)
     {
+        if (PGROUNDUP(sz + n) < PGROUNDUP(sz))
+        {
+            // a superpage the new end falls inside is split
+            // first, so that only the pages past it are freed.
+            if (uvmsplit(p->pagetable, PGROUNDUP(sz + n)) < 0)
+            {
+                release(&p->vm_lock);
+                return -1;
+            }
+            // drop the reservation of pages given back untouched, so
+            // vmstat only counts those still held as avoided.
+            __sync_fetch_and_sub(&vmstat.lazy_pages,
+                                 uvmuntouched(p->pagetable, PGROUNDUP(sz + n), (PGROUNDUP(sz) - PGROUNDUP(sz + n)) / PGSIZE));
+        }
         sz = uvmdealloc(p->pagetable, sz, sz + n);
+        asidflushall(p);
     }
     p->sz = sz;
+    release(&p->vm_lock);
     return 0;
 }
 
@@ -296,6 +459,7 @@ int fork(void)
     struct proc *p = myproc();
     struct kthread *kt = mykthread();
 
+retry:
     // Allocate process.
     if ((np = allocproc()) == 0)
     {
@@ -304,13 +468,18 @@ int fork(void)
 
     // Copy user memory from parent to child.
     if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0)
-    {
-        freeproc(np);
-        release(&np->lock);
-        return -1;
-    }
-    np->state = USED;
+        goto nomem;
     np->sz = p->sz;
+    if (vmacopy(p, np) < 0)
+        goto nomem;
+    np->state = USED;
+
+    // pages the parent never touched are still paged in
+    // from the executable.
+    if (p->execip)
+        np->execip = idup(p->execip);
+    memmove(np->execseg, p->execseg, sizeof(p->execseg));
+    np->nexecseg = p->nexecseg;
 
     // copy saved user registers.
     *(np->kthread[0].trapframe) = *(kt->trapframe);
@@ -341,6 +510,16 @@ int fork(void)
     release(&np->lock);
     // printf("fork 2\n");
     return pid;
+
+nomem:
+    // out of memory: wait for exited processes' memory to be
+    // freed, or evict some to swap, and try again.
+    release(&np->kthread[0].lock);
+    freeproc(np);
+    release(&np->lock);
+    if (uvmreapwait() || reclaim(SWAPBATCH) > 0)
+        goto retry;
+    return -1;
 }
 
 // Pass p's abandoned children to init.
@@ -371,6 +550,11 @@ void exit(int status)
     if (p == initproc)
         panic("init exiting");
 
+    // Unmap mmap() regions, writing back shared file pages,
+    // while the files are still open.
+    vmaunmapall(p);
+    shmexit(p->pid);
+
     // Close all open files.
     for (int fd = 0; fd < NOFILE; fd++)
     {
@@ -382,8 +566,16 @@ void exit(int status)
         }
     }
 
+    acquire(&p->vm_lock);
+    struct inode *execip = p->execip;
+    p->execip = 0;
+    p->nexecseg = 0;
+    release(&p->vm_lock);
+
     begin_op();
     iput(p->cwd);
+    if (execip)
+        iput(execip);
     end_op();
     p->cwd = 0;
 
@@ -468,6 +660,9 @@ int kthread_create(void *(*start_func)(), void *stack, uint stack_size)
     kt->trapframe->epc = (uint64)start_func;
     // kt->kstack = (uint64)stack; // in group they said to remove it, but if I do there is kernel trap
     kt->trapframe->sp = (uint64)stack + stack_size;
+    // user code keeps per-thread data at tp (see umalloc.c),
+    // which a new thread hasn't set up yet.
+    kt->trapframe->tp = 0;
     kt->state = RUNNABLE;
     release(&kt->lock);
     // maybe realse the kt key??? (was aquired in alloc_kthread)
@@ -485,13 +680,14 @@ int wait(uint64 addr) // TODO
 {
     // printf("enters wait CPU %d\n", cpuid());
     struct proc *pp;
-    int havekids, pid;
+    int havekids, pid, xstate;
     struct proc *p = myproc();
 
     acquire(&wait_lock);
 
     for (;;)
     {
+rescan:
         // Scan through table looking for exited children.
         havekids = 0;
         for (pp = proc; pp < &proc[NPROC]; pp++)
@@ -506,13 +702,28 @@ int wait(uint64 addr) // TODO
                 {
                     // Found one.
                     pid = pp->pid;
-                    if (addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                             sizeof(pp->xstate)) < 0)
+                    xstate = pp->xstate;
+                    if (addr != 0)
                     {
+                        // copy out without locks held, since faulting
+                        // in the user page may sleep. The child stays
+                        // a zombie until its status is out, so a failed
+                        // copyout loses nothing.
                         release(&pp->lock);
                         release(&wait_lock);
-                        printf("FAIL COPYOUT\n");
-                        return -1;
+                        if (copyout(p->pagetable, addr, (char *)&xstate, sizeof(xstate)) < 0)
+                        {
+                            printf("FAIL COPYOUT\n");
+                            return -1;
+                        }
+                        acquire(&wait_lock);
+                        acquire(&pp->lock);
+                        if (pp->state != ZOMBIE || pp->pid != pid || pp->parent != p)
+                        {
+                            // a sibling kthread reaped it meanwhile.
+                            release(&pp->lock);
+                            goto rescan;
+                        }
                     }
                     freeproc(pp);
                     release(&pp->lock);
@@ -543,6 +754,7 @@ int kthread_join(int ktid, int *status)
     //printf("JOIN on TID %d \n", ktid);
     struct proc *p = myproc();
     struct kthread *kt;
+    int xstate;
 
     for (kt = p->kthread; kt < &p->kthread[NKT]; kt++)
     {
@@ -563,16 +775,14 @@ int kthread_join(int ktid, int *status)
         if (kt->state == ZOMBIE)
         {
             acquire(&kt->lock);
-            if (status != 0 && copyout(p->pagetable, (uint64)status, (char *)&kt->xstate,
-                                       sizeof(kt->xstate)) < 0)
-            {
-                release(&kt->lock);
-                release(&p->lock);
-                return -1;
-            }
-
+            xstate = kt->xstate;
             free_kthread(kt);
             release(&p->lock);
+            // copy out without locks held, since faulting
+            // in the user page may sleep.
+            if (status != 0 && copyout(p->pagetable, (uint64)status, (char *)&xstate,
+                                       sizeof(xstate)) < 0)
+                return -1;
             return 0;
         }
         if (kt == 0  || kthread_killed(kt))
@@ -588,50 +798,170 @@ int kthread_join(int ktid, int *status)
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
 //  - choose a process to run.
-//  - swtch to start running that process.
-//  - eventually that process transfers control
+//  - swtch to start running each of its runnable kthreads
+//    in turn, staying on the process's page table, and with
+//    its TLB entries, from one kthread to the next.
+//  - eventually each kthread transfers control
 //    via swtch back to the scheduler.
+// A pass over the process table only picks kthreads that
+// last ran on this hart, or have never run, whose TLB and
+// cache contents are likely still here. A hart that finds
+// none takes any runnable kthread on its next pass.
 void scheduler(void)
 {
     // printf("scheduler\n");
     struct proc *p;
+    struct kthread *kt;
     struct cpu *c = mycpu();
+    int id = cpuid(), affine = 1, ran;
 
     c->thread = 0;
     for (;;)
     {
         // Avoid deadlock by ensuring that devices can interrupt.
         intr_on();
+        ran = 0;
         for (p = proc; p < &proc[NPROC]; p++)
         {
-            // acquire(&p->lock);
-            if (p->state == USED)
+            if (p->state != USED)
+                continue;
+            for (kt = p->kthread; kt < &p->kthread[NKT]; kt++)
             {
-                // Switch to chosen process.  It is the process's job
-                // to release its lock and then reacquire it
-                // before jumping back to us.
-                for (struct kthread *kt = p->kthread; kt < &p->kthread[NKT]; kt++)
+                acquire(&kt->lock);
+                if (kt->state == RUNNABLE && p->state == USED &&
+                    (!affine || kt->cpu == id || kt->cpu < 0))
                 {
-                    acquire(&kt->lock);
-                    // if(kt->state == ZOMBIE)
-                    //     printf("ZOMBIE?\n");
-
-                    if (kt->state == RUNNABLE && p->state == USED)
-                    {
-                        kt->state = RUNNING;
-                        c->thread = kt;
-                        swtch(&c->context, &kt->context);
-                        c->thread = 0;
-                        // c->proc = 0;
-                    }
-                    release(&kt->lock);
+                    // Switch to chosen kthread.  It is the kthread's job
+                    // to release its lock and then reacquire it
+                    // before jumping back to us.
+                    kt->state = RUNNING;
+                    if (kt->cpu >= 0 && kt->cpu != id)
+                        __sync_fetch_and_add(&vmstat.migrations, 1);
+                    kt->cpu = id;
+                    c->thread = kt;
+                    // run on the process's kernel page table, so
+                    // that copyin() and copyout() can reach user
+                    // memory directly. a sibling that just ran
+                    // here left it installed.
+                    if (c->kpagetable == p->kpagetable)
+                        __sync_fetch_and_add(&vmstat.samemm_switches, 1);
+                    switchuvm(p);
+                    swtch(&c->context, &kt->context);
+                    c->thread = 0;
+                    ran = 1;
                 }
-                // Process is done running for now.
-                // It should have changed its p->state before coming back.
+                release(&kt->lock);
             }
-            // release(&p->lock);
+            // Process is done running for now.
+            if (c->kpagetable)
+                kvmswitch();
         } // for p
+        affine = ran || !affine;
+    }
+}
+
+// Give p a new ASID, starting a new generation if this
+// one's have run out. Without ASIDs, every call starts a
+// new generation. Caller holds asids.lock.
+static void
+asidalloc(struct proc *p)
+{
+    if (asids.next > asids.max)
+    {
+        asids.gen++;
+        asids.next = 1;
+    }
+    p->asid = asids.max ? asids.next++ : 0;
+    p->asidgen = asids.gen;
+    p->asidcpus = 0;
+}
+
+// Install p's kernel page table on this hart, tagged with
+// p's ASID, giving p a new ASID if its own is from an older
+// generation, and flushing the TLB if this hart hasn't since
+// the generation started. Called whenever a kthread of p
+// starts running, or enters or leaves the kernel, so that
+// every hart picks up a new ASID soon after it's assigned.
+void
+switchuvm(struct proc *p)
+{
+    struct cpu *c;
+    uint64 satp;
+    int flush;
+
+    push_off();
+    c = mycpu();
+    if (p->asidgen == asids.gen && c->asidgen == asids.gen &&
+        r_satp() == MAKE_SATP_ASID(p->kpagetable, p->asid))
+    {
+        pop_off();
+        return;
+    }
+    acquire(&asids.lock);
+    if (p->asidgen != asids.gen)
+        asidalloc(p);
+    flush = c->asidgen != asids.gen || asids.max == 0;
+    c->asidgen = asids.gen;
+    p->asidcpus |= 1L << cpuid();
+    satp = MAKE_SATP_ASID(p->kpagetable, p->asid);
+    release(&asids.lock);
+    w_satp(satp);
+    if (flush)
+        sfence_vma();
+    c->kpagetable = p->kpagetable;
+    pop_off();
+}
+
+// Make a change to p's mappings take effect, once it no
+// longer grants an access, or maps a different page. If only
+// this hart has used p's ASID, flushing va (or everything,
+// if all) from its TLB is enough. Otherwise p gets a new
+// ASID, which the other harts switch to the next time they
+// enter or leave the kernel for p, and the stale entries
+// they hold for the old one are never used again.
+// p must be running on this hart.
+static void
+asidsync(struct proc *p, uint64 va, int all)
+{
+    push_off();
+    acquire(&asids.lock);
+    if (p->asidgen == asids.gen && p->asidcpus == 1L << cpuid())
+    {
+        release(&asids.lock);
+        if (all)
+            sfence_vma_asid(p->asid);
+        else
+            sfence_vma_page(va, p->asid);
+    }
+    else
+    {
+        p->asidgen = 0;
+        release(&asids.lock);
+        switchuvm(p);
     }
+    pop_off();
+}
+
+void
+asidflush(struct proc *p, uint64 va)
+{
+    asidsync(p, va, 0);
+}
+
+void
+asidflushall(struct proc *p)
+{
+    asidsync(p, 0, 1);
+}
+
+// Give p, which is not running, a new ASID the next time it
+// runs, after a change to its mappings.
+void
+asidretire(struct proc *p)
+{
+    acquire(&asids.lock);
+    p->asidgen = 0;
+    release(&asids.lock);
 }
 
 // Switch to scheduler.  Must hold only p->lock
@@ -694,6 +1024,7 @@ void forkret(void)
         // be run from main().
         first = 0;
         fsinit(ROOTDEV);
+        swapinit();
     }
 
     usertrapret();
@@ -734,6 +1065,16 @@ void sleep(void *chan, struct spinlock *lk) // TODO
     acquire(lk);
 }
 
+// Wake kthread kt if it is sleeping on chan. Unlike wakeup(),
+// takes no process's lock, so the caller may hold one.
+void wakeupkt(struct kthread *kt, void *chan)
+{
+    acquire(&kt->lock);
+    if (kt->state == SLEEPING && kt->chan == chan)
+        kt->state = RUNNABLE;
+    release(&kt->lock);
+}
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 // dasgsdgsdg
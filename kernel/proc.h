@@ -1,5 +1,28 @@
 #include "kthread.h"
 
+// An ELF segment that exec() left to be paged in from
+// the executable on first touch.
+struct execseg
+{
+    uint64 vaddr;  // first virtual address, page-aligned
+    uint64 memsz;  // bytes of memory, including bss
+    uint64 filesz; // bytes backed by the file
+    uint64 off;    // file offset of vaddr
+    int perm;      // PTE_W and/or PTE_X
+};
+
+// A region of memory created by mmap().
+struct vma
+{
+    uint64 start;   // first address, page-aligned; 0 if unused
+    uint64 len;     // bytes, a multiple of PGSIZE
+    int prot;       // PTE_R, PTE_W and/or PTE_X
+    int flags;      // MAP_SHARED or MAP_PRIVATE, and MAP_ANONYMOUS
+    struct file *f; // mapped file, or 0 if anonymous
+    struct shm *shm; // shared memory object, for MAP_SHARED
+    uint64 off;     // offset of start in the file or object
+};
+
 // Per-process state
 struct proc
 {
@@ -24,6 +47,16 @@ struct proc
     //uint64 kstack;              // Virtual address of kernel stack
     uint64 sz;                  // Size of process memory (bytes)
     pagetable_t pagetable;      // User page table
+    pagetable_t kpagetable;     // Kernel page table, sharing user memory
+    struct spinlock vm_lock;    // serializes page faults of sibling kthreads
+    int asid;                   // TLB tag of both page tables; see switchuvm()
+    uint64 asidgen;             // ASID generation asid belongs to, or 0
+    uint64 asidcpus;            // harts whose TLBs may hold entries for asid
+    struct inode *execip;       // executable that execseg pages come from
+    struct execseg execseg[NEXECSEG];
+    int nexecseg;
+    struct vma vma[NVMA];       // mmap() regions, protected by vm_lock
+    uint64 faults[NFAULT];      // page faults of each kind; see fault.h
     struct file *ofile[NOFILE]; // Open files
     struct inode *cwd;          // Current directory
     char name[16];              // Process name (debugging)
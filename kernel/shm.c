@@ -0,0 +1,365 @@
+// Shared memory objects, for shmget()/shmat() segments and
+// MAP_SHARED mmap() regions. An object owns one reference to
+// each of its pages; each page table mapping a page holds
+// another, so pages outlive the object only while still
+// mapped.
+//
+// The MAP_SHARED regions of a file share one object, which
+// the inode points to, so every process mapping the file
+// maps the same pages. Each page is read from the file on
+// first use, and is newer than the disk until the mappings
+// that wrote it are removed; readi() and writei() use the
+// page instead of the disk block meanwhile.
+//
+// An object finds its pages through a radix tree of page
+// tables, as deep as its size needs, so there is no limit on
+// its size but the address space. Segments live in a table
+// of NSHM, where shmget() finds them by key; anonymous
+// objects are allocated as needed, with no limit on how many
+// there are.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "shm.h"
+
+#define SHMFAN (PGSIZE / sizeof(uint64))   // entries per table
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+  struct shm *anonfree;  // unused anonymous objects, linked by pages
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+}
+
+// Set up s to hold npages pages, with an empty tree.
+// Returns 0, or -1 if out of memory. Caller holds shmtab.lock.
+static int
+shminitpages(struct shm *s, uint64 npages)
+{
+  uint64 n;
+
+  if((s->pages = (uint64*)kalloc()) == 0)
+    return -1;
+  memset(s->pages, 0, PGSIZE);
+  s->npages = npages;
+  for(s->depth = 1, n = SHMFAN; n < npages; n *= SHMFAN)
+    s->depth++;
+  return 0;
+}
+
+// Free a tree of page tables below level (0 for the
+// leaves' table), dropping the references to its pages.
+static void
+shmfreetree(uint64 *t, int level)
+{
+  int i;
+
+  for(i = 0; i < SHMFAN; i++){
+    if(t[i] == 0)
+      continue;
+    if(level > 0)
+      shmfreetree((uint64*)t[i], level - 1);
+    else
+      kfree((void*)t[i]);
+  }
+  kfree(t);
+}
+
+// Return the address of the entry for page i of s, making
+// the tables on the way if they aren't there yet and alloc
+// is set. Returns 0 if there is no table, or if out of
+// memory. Caller holds shmtab.lock.
+static uint64 *
+shmslot(struct shm *s, uint64 i, int alloc)
+{
+  uint64 *t = s->pages, *e;
+  int level;
+
+  for(level = s->depth - 1; level > 0; level--){
+    e = &t[(i >> (9 * level)) & (SHMFAN - 1)];
+    if(*e == 0){
+      if(!alloc || (*e = (uint64)kalloc()) == 0)
+        return 0;
+      memset((void*)*e, 0, PGSIZE);
+    }
+    t = (uint64*)*e;
+  }
+  return &t[i & (SHMFAN - 1)];
+}
+
+// Find the segment with a positive key, or create it with
+// room for len bytes. A segment found by key must be at
+// least len bytes. Returns the segment's id, or -1.
+int
+shmget(int key, uint64 len)
+{
+  struct shm *s, *free = 0;
+  int id = -1;
+
+  if(key <= 0 || len == 0 || len > MMAPTOP)
+    return -1;
+
+  acquire(&shmtab.lock);
+  for(s = shmtab.shm; s < &shmtab.shm[NSHM]; s++){
+    if(s->npages && s->key == key){
+      if(len <= (uint64)s->npages * PGSIZE)
+        id = s - shmtab.shm;
+      release(&shmtab.lock);
+      return id;
+    }
+    if(s->npages == 0 && free == 0)
+      free = s;
+  }
+  if(free && shminitpages(free, PGROUNDUP(len) / PGSIZE) == 0){
+    free->key = key;
+    free->ref = 0;
+    free->creator = myproc()->pid;
+    free->ip = 0;
+    id = free - shmtab.shm;
+  }
+  release(&shmtab.lock);
+  return id;
+}
+
+// Return segment id with one more attachment, or 0 if
+// there is no such segment.
+struct shm *
+shmattach(int id)
+{
+  struct shm *s = 0;
+
+  if(id < 0 || id >= NSHM)
+    return 0;
+  acquire(&shmtab.lock);
+  if(shmtab.shm[id].npages){
+    s = &shmtab.shm[id];
+    s->ref++;
+  }
+  release(&shmtab.lock);
+  return s;
+}
+
+// Make an unnamed object of len bytes, with one attachment.
+// Returns 0 if out of memory. Caller holds shmtab.lock.
+static struct shm *
+shmnew(uint64 len)
+{
+  struct shm *s;
+  char *mem;
+  int i;
+
+  if(shmtab.anonfree == 0 && (mem = kalloc()) != 0){
+    for(i = 0; i + sizeof(*s) <= PGSIZE; i += sizeof(*s)){
+      s = (struct shm*)(mem + i);
+      s->pages = (uint64*)shmtab.anonfree;
+      shmtab.anonfree = s;
+    }
+  }
+  if((s = shmtab.anonfree) != 0){
+    shmtab.anonfree = (struct shm*)s->pages;
+    if(shminitpages(s, PGROUNDUP(len) / PGSIZE) == 0){
+      s->key = -1;
+      s->ref = 1;
+      s->creator = 0;
+      s->ip = 0;
+    } else {
+      s->pages = (uint64*)shmtab.anonfree;
+      shmtab.anonfree = s;
+      s = 0;
+    }
+  }
+  return s;
+}
+
+// Create an unnamed object of len bytes for an anonymous
+// MAP_SHARED region, with one attachment. Returns 0 if out
+// of memory.
+struct shm *
+shmanon(uint64 len)
+{
+  struct shm *s;
+
+  acquire(&shmtab.lock);
+  s = shmnew(len);
+  release(&shmtab.lock);
+  return s;
+}
+
+// Return the object for MAP_SHARED regions of file ip, with
+// one more attachment, making it if there is none. It covers
+// as much of the file as an mmap() region can. Returns 0 if
+// out of memory.
+struct shm *
+shmfile(struct inode *ip)
+{
+  struct shm *s;
+
+  acquire(&shmtab.lock);
+  if((s = ip->mmap) != 0){
+    s->ref++;
+  } else if((s = shmnew(MMAPTOP)) != 0){
+    s->ip = ip;
+    ip->mmap = s;
+  }
+  release(&shmtab.lock);
+  return s;
+}
+
+// Add an attachment, for fork() or a split region.
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  if(s->ref < 1)
+    panic("shmdup");
+  s->ref++;
+  release(&shmtab.lock);
+}
+
+// Take s out of use, returning its tree for the caller to
+// free. Caller holds shmtab.lock.
+static uint64 *
+shmremove(struct shm *s, int *depth)
+{
+  uint64 *pages = s->pages;
+
+  *depth = s->depth;
+  s->npages = 0;
+  s->creator = 0;
+  if(s->ip)
+    s->ip->mmap = 0;
+  s->ip = 0;
+  if(s->key < 0){
+    s->pages = (uint64*)shmtab.anonfree;
+    shmtab.anonfree = s;
+  } else {
+    s->pages = 0;
+  }
+  s->key = 0;
+  return pages;
+}
+
+// Drop an attachment; the last one frees the object,
+// along with its references to its pages.
+void
+shmput(struct shm *s)
+{
+  uint64 *pages;
+  int depth;
+
+  acquire(&shmtab.lock);
+  if(s->ref < 1)
+    panic("shmput");
+  if(--s->ref > 0){
+    release(&shmtab.lock);
+    return;
+  }
+  pages = shmremove(s, &depth);
+  release(&shmtab.lock);
+  shmfreetree(pages, depth - 1);
+}
+
+// Free the segments that exiting process pid created and
+// nobody ever attached.
+void
+shmexit(int pid)
+{
+  struct shm *s;
+  uint64 *pages;
+  int depth;
+
+  for(s = shmtab.shm; s < &shmtab.shm[NSHM]; s++){
+    acquire(&shmtab.lock);
+    if(s->npages == 0 || s->creator != pid || s->ref > 0){
+      release(&shmtab.lock);
+      continue;
+    }
+    pages = shmremove(s, &depth);
+    release(&shmtab.lock);
+    shmfreetree(pages, depth - 1);
+  }
+}
+
+// Return the physical address of page i of s, allocating
+// a zeroed page on first use, with an extra reference for
+// the caller's mapping. Returns 0 if out of range or out
+// of memory.
+uint64
+shmpage(struct shm *s, uint64 i)
+{
+  uint64 pa = 0, *e;
+  char *mem;
+
+  acquire(&shmtab.lock);
+  if(i < s->npages && (e = shmslot(s, i, 1)) != 0){
+    if(*e == 0 && (mem = kalloc()) != 0){
+      memset(mem, 0, PGSIZE);
+      *e = (uint64)mem;
+    }
+    if((pa = *e) != 0)
+      krefinc((void*)pa);
+  }
+  release(&shmtab.lock);
+  return pa;
+}
+
+// Make mem, a page read from s's file, page i of s, unless
+// it has one by now, in which case mem is freed. Returns the
+// physical address of page i with an extra reference for the
+// caller's mapping, or 0 if out of range or out of memory.
+uint64
+shmset(struct shm *s, uint64 i, char *mem)
+{
+  uint64 pa = 0, *e;
+
+  acquire(&shmtab.lock);
+  if(i < s->npages && (e = shmslot(s, i, 1)) != 0){
+    if(*e == 0){
+      *e = (uint64)mem;
+      mem = 0;
+    }
+    pa = *e;
+    krefinc((void*)pa);
+  }
+  release(&shmtab.lock);
+  if(mem)
+    kfree(mem);
+  return pa;
+}
+
+// Return the physical address of page i of the object for
+// file ip's MAP_SHARED regions, with an extra reference, or
+// 0 if there is no such page.
+uint64
+shmfilepage(struct inode *ip, uint64 i)
+{
+  struct shm *s;
+  uint64 pa = 0, *e;
+
+  acquire(&shmtab.lock);
+  if((s = ip->mmap) != 0 && i < s->npages &&
+     (e = shmslot(s, i, 0)) != 0 && (pa = *e) != 0)
+    krefinc((void*)pa);
+  release(&shmtab.lock);
+  return pa;
+}
+
+// Size of s in bytes.
+uint64
+shmsize(struct shm *s)
+{
+  return (uint64)s->npages * PGSIZE;
+}
@@ -0,0 +1,10 @@
+// A shared memory object.
+struct shm {
+  int key;        // shmget() key; negative for MAP_SHARED regions
+  int ref;        // attachments (mmap() regions) using it
+  int creator;    // pid of shmget()'s caller, for shmexit()
+  int depth;      // levels of tables in pages
+  uint64 npages;  // size in pages; 0 if this entry is unused
+  uint64 *pages;  // tables of physical addresses of pages, 0 if untouched
+  struct inode *ip; // file whose MAP_SHARED pages these are, or 0
+};
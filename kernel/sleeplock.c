@@ -15,6 +15,7 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->kt = 0;
   lk->pid = 0;
 }
 
@@ -26,6 +27,7 @@ acquiresleep(struct sleeplock *lk)
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
+  lk->kt = mykthread();
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
@@ -35,18 +37,21 @@ releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   lk->locked = 0;
+  lk->kt = 0;
   lk->pid = 0;
   wakeup(lk);
   release(&lk->lk);
 }
 
+// Does the calling kthread hold lk? A sibling kthread of
+// the same process holding it doesn't count.
 int
 holdingsleep(struct sleeplock *lk)
 {
   int r;
   
   acquire(&lk->lk);
-  r = lk->locked && (lk->pid == myproc()->pid);
+  r = lk->locked && lk->kt == mykthread();
   release(&lk->lk);
   return r;
 }
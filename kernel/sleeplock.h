@@ -2,6 +2,7 @@
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
+  struct kthread *kt; // kthread holding lock
   
   // For debugging:
   char *name;        // Name of lock.
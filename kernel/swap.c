@@ -0,0 +1,368 @@
+// Page reclaim and swap space.
+//
+// When free memory runs low, reclaim() sweeps a clock hand
+// over the user pages of every process, giving pages whose
+// PTE_A bit is set a second chance (and clearing the bit),
+// and writing the others out to swap. A swapped-out page's
+// PTE is left invalid, with PTE_SWAP set and the swap slot
+// in place of the physical page number; the next access
+// faults, and swapin() reads the page back.
+//
+// Swap space is the part of the disk after the file system,
+// divided into page-sized slots. Each PTE that refers to a
+// slot holds a reference to it, so that fork() can share
+// swapped-out pages the way it would copies of them. A slot's
+// page is kept compressed in RAM instead, by zram.c, if it
+// compresses well.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "mman.h"
+#include "vmstat.h"
+
+#define BPP (PGSIZE / BSIZE)  // disk blocks per page
+#define LOWPAGES 64           // reclaim when fewer pages are free
+#define SCANMAX 256           // pages to look at while holding a process's locks
+
+struct {
+  struct spinlock lock;
+  uint start;           // first block of slot 0
+  int nslot;            // number of slots
+  int next;             // where to start looking for a free slot
+  uchar ref[NSWAP];     // PTEs referring to each slot
+  uchar busy[NSWAP];    // slot is being written
+
+  // only one reclaim() at a time moves the clock hand.
+  struct sleeplock reclaiming;
+  int hand;             // process the hand is at
+  uint64 handva;        // and the address in it
+} swap;
+
+extern struct superblock sb;
+extern struct proc proc[NPROC];
+
+// Set up swap space in the disk blocks after the file
+// system. Needs the superblock, so is called after fsinit().
+void
+swapinit(void)
+{
+  uint64 size = virtio_disk_size();
+  int n = 0;
+
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.reclaiming, "reclaim");
+  zraminit();
+  swap.start = sb.size;
+  if(size > sb.size)
+    n = (size - sb.size) / BPP;
+  swap.nslot = n < NSWAP ? n : NSWAP;
+  vmstat.swap_slots = swap.nslot;
+}
+
+// Allocate a slot, with one reference, marked busy until
+// swapwrite() fills it. Returns -1 if swap is full.
+static int
+swapalloc(void)
+{
+  int i, s;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    s = (swap.next + i) % swap.nslot;
+    if(swap.ref[s] == 0 && !swap.busy[s]){
+      swap.ref[s] = 1;
+      swap.busy[s] = 1;
+      swap.next = s + 1;
+      vmstat.swap_used++;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Add a reference to slot s, for a PTE copied by fork().
+void
+swapdup(int s)
+{
+  acquire(&swap.lock);
+  if(swap.ref[s] == 0 || swap.ref[s] == 255)
+    panic("swapdup");
+  swap.ref[s]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot s. The last one frees it,
+// once any write to it has finished.
+void
+swapput(int s)
+{
+  acquire(&swap.lock);
+  if(swap.ref[s] == 0)
+    panic("swapput");
+  if(--swap.ref[s] == 0){
+    vmstat.swap_used--;
+    if(!swap.busy[s])
+      zramfree(s);
+  }
+  release(&swap.lock);
+}
+
+// Write page pa to slot s, in RAM if it compresses, and
+// free the page.
+static void
+swapwrite(int s, char *pa)
+{
+  struct buf *b;
+  int i;
+
+  if(zramstore(s, pa) < 0){
+    for(i = 0; i < BPP; i++){
+      b = bnew(ROOTDEV, swap.start + s*BPP + i);
+      memmove(b->data, pa + i*BSIZE, BSIZE);
+      bwrite(b);
+      brelse(b);
+    }
+  }
+  acquire(&swap.lock);
+  swap.busy[s] = 0;
+  if(swap.ref[s] == 0)
+    zramfree(s);
+  wakeup(&swap.busy[s]);
+  release(&swap.lock);
+  kfree(pa);
+  __sync_fetch_and_add(&vmstat.swap_outs, 1);
+}
+
+// Read slot s into page pa, waiting for it to be written
+// first if it is still on its way out.
+static void
+swapread(int s, char *pa)
+{
+  struct buf *b;
+  uint64 t0;
+  int i;
+
+  acquire(&swap.lock);
+  while(swap.busy[s])
+    sleep(&swap.busy[s], &swap.lock);
+  release(&swap.lock);
+  t0 = r_time();
+  if(zramload(s, pa) == 0){
+    __sync_fetch_and_add(&vmstat.zram_in_time, r_time() - t0);
+  } else {
+    for(i = 0; i < BPP; i++){
+      b = bread(ROOTDEV, swap.start + s*BPP + i);
+      memmove(pa + i*BSIZE, b->data, BSIZE);
+      brelse(b);
+    }
+    __sync_fetch_and_add(&vmstat.disk_in_time, r_time() - t0);
+  }
+  __sync_fetch_and_add(&vmstat.swap_ins, 1);
+}
+
+// If page va of p is swapped out, read it back in.
+// Returns 1 if it isn't swapped out, 0 if the access can
+// be retried, and -1 if out of memory. May sleep.
+int
+swapin(struct proc *p, uint64 va)
+{
+  pte_t *pte, old;
+  char *mem;
+  int s, super;
+
+  acquire(&p->vm_lock);
+  pte = walkleaf(p->pagetable, va, &super);
+  if(pte == 0 || (*pte & PTE_SWAP) == 0){
+    release(&p->vm_lock);
+    return 1;
+  }
+  old = *pte;
+  s = PTE2SLOT(old);
+  // keep the slot while reading it, in case a sibling
+  // kthread unmaps the page meanwhile.
+  swapdup(s);
+  release(&p->vm_lock);
+
+  if((mem = kalloc()) == 0){
+    swapput(s);
+    return -1;
+  }
+  swapread(s, mem);
+
+  acquire(&p->vm_lock);
+  pte = walkleaf(p->pagetable, va, &super);
+  if(pte && *pte == old){
+    *pte = PA2PTE(mem) | PTE_FLAGS(old & ~PTE_SWAP) | PTE_V;
+    swapput(s);
+    mem = 0;
+  }
+  release(&p->vm_lock);
+  swapput(s);
+  if(mem)
+    kfree(mem);
+  return 0;
+}
+
+// Return the lowest page address at or above va where
+// reclaim() may find pages of q to evict: in its heap, or in
+// a private mmap() region. Pages of shared regions are never
+// evicted. Returns MAXVA if there are none.
+// Caller holds q->vm_lock.
+static uint64
+nextva(struct proc *q, uint64 va)
+{
+  struct vma *v;
+  uint64 a = MAXVA, b;
+
+  if(va < q->sz)
+    return va;
+  for(v = q->vma; v < &q->vma[NVMA]; v++){
+    if(v->len == 0 || (v->flags & MAP_SHARED) || va >= v->start + v->len)
+      continue;
+    b = va > v->start ? va : v->start;
+    if(b < a)
+      a = b;
+  }
+  return a;
+}
+
+// Sweep the clock hand over q from swap.handva, looking at
+// up to SCANMAX pages, and evict up to n of them: take
+// them out of q's page table, giving each a swap slot, and
+// record them in pa[] and slot[] for the caller to write
+// out. Returns the number evicted, setting *full if swap
+// ran out; sets swap.handva to MAXVA when the hand has
+// passed all of q.
+// Caller holds q->lock, q->vm_lock and the locks of all of
+// q's kthreads, none of which is running but the caller.
+static int
+scan(struct proc *q, int n, char **pa, int *slot, int *full)
+{
+  uint64 va = swap.handva, a;
+  pte_t *pte;
+  int i, k = 0, super, s;
+
+  for(i = 0; i < SCANMAX && k < n; i++){
+    if((va = nextva(q, va)) >= MAXVA)
+      break;
+    pte = walkleaf(q->pagetable, va, &super);
+    if(pte == 0){
+      // no page-table page for this 2 MB block.
+      va = SUPERPGROUNDDOWN(va) + SUPERPGSIZE;
+      continue;
+    }
+    if(super){
+      __sync_fetch_and_add(&vmstat.reclaim_scanned, 1);
+      if(*pte & PTE_A){
+        *pte &= ~PTE_A;
+        __sync_fetch_and_add(&vmstat.reclaim_referenced, 1);
+        va = SUPERPGROUNDDOWN(va) + SUPERPGSIZE;
+        continue;
+      }
+      // cold: split it, and evict its pages one at a time.
+      if((pte = walk(q->pagetable, va, 1)) == 0){
+        va = SUPERPGROUNDDOWN(va) + SUPERPGSIZE;
+        continue;
+      }
+    }
+    a = va;
+    va += PGSIZE;
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) ||
+       (*pte & (PTE_R|PTE_W|PTE_X)) == 0 ||
+       PTE2PA(*pte) == (uint64)zeropage ||
+       krefcount((void*)PTE2PA(*pte)) != 1)
+      continue;
+    __sync_fetch_and_add(&vmstat.reclaim_scanned, 1);
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      __sync_fetch_and_add(&vmstat.reclaim_referenced, 1);
+      continue;
+    }
+    if((s = swapalloc()) < 0){
+      *full = 1;
+      va = a;
+      break;
+    }
+    pa[k] = (char*)PTE2PA(*pte);
+    slot[k] = s;
+    k++;
+    *pte = SWAPPTE(s, PTE_FLAGS(*pte) & ~(PTE_V|PTE_A|PTE_D));
+  }
+  swap.handva = va;
+  return k;
+}
+
+// Evict up to n cold user pages to swap. Returns the number
+// evicted, which is 0 if there is no swap space left, or
+// no page is cold even after the hand has gone around twice.
+// May sleep; the caller must hold no spinlocks.
+int
+reclaim(int n)
+{
+  char *pa[SWAPBATCH];
+  int slot[SWAPBATCH];
+  struct proc *q, *p = myproc();
+  int i, k, done = 0, full = 0, steps;
+
+  if(swap.nslot == 0)
+    return 0;
+  if(n > SWAPBATCH)
+    n = SWAPBATCH;
+  acquiresleep(&swap.reclaiming);
+  // twice around every page, at most SCANMAX at a time.
+  steps = 2 * ((PHYSTOP - KERNBASE) / PGSIZE / SCANMAX + NPROC);
+  while(done < n && !full && steps-- > 0){
+    q = &proc[swap.hand];
+    k = 0;
+    acquire(&q->lock);
+    if(q->state == USED){
+      acquire(&q->vm_lock);
+      if(kthreadlockall(q)){
+        k = scan(q, n - done, pa, slot, &full);
+        if(k > 0){
+          if(q == p)
+            asidflushall(q);
+          else
+            asidretire(q);
+        }
+        kthreadunlockall(q);
+      } else {
+        swap.handva = MAXVA;
+      }
+      release(&q->vm_lock);
+    } else {
+      swap.handva = MAXVA;
+    }
+    release(&q->lock);
+    if(swap.handva >= MAXVA){
+      swap.hand = (swap.hand + 1) % NPROC;
+      swap.handva = 0;
+    }
+
+    for(i = 0; i < k; i++)
+      swapwrite(slot[i], pa[i]);
+    done += k;
+  }
+  releasesleep(&swap.reclaiming);
+  return done;
+}
+
+// Reclaim a batch of pages if free memory is low.
+// Returns the number reclaimed.
+int
+reclaimlow(void)
+{
+  if(kfreepages() >= LOWPAGES)
+    return 0;
+  return reclaim(SWAPBATCH);
+}
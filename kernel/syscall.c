@@ -106,6 +106,18 @@ extern uint64 sys_kthread_id(void);
 extern uint64 sys_kthread_kill(void);
 extern uint64 sys_kthread_exit(void);
 extern uint64 sys_kthread_join(void);
+extern uint64 sys_vmstat(void);
+extern uint64 sys_vmtune(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_shmget(void);
+extern uint64 sys_shmat(void);
+extern uint64 sys_shmdt(void);
+extern uint64 sys_meminfo(void);
+extern uint64 sys_faultstat(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_sigalarm(void);
+extern uint64 sys_sigreturn(void);
 
 
 // An array mapping syscall numbers from syscall.h
@@ -136,7 +148,19 @@ static uint64 (*syscalls[])(void) = {
 [SYS_kthread_id]    sys_kthread_id,
 [SYS_kthread_kill]    sys_kthread_kill,
 [SYS_kthread_exit]    sys_kthread_exit,
-[SYS_kthread_join]    sys_kthread_join
+[SYS_kthread_join]    sys_kthread_join,
+[SYS_vmstat]    sys_vmstat,
+[SYS_vmtune]    sys_vmtune,
+[SYS_mmap]      sys_mmap,
+[SYS_munmap]    sys_munmap,
+[SYS_shmget]    sys_shmget,
+[SYS_shmat]     sys_shmat,
+[SYS_shmdt]     sys_shmdt,
+[SYS_meminfo]   sys_meminfo,
+[SYS_faultstat] sys_faultstat,
+[SYS_poll]      sys_poll,
+[SYS_sigalarm]  sys_sigalarm,
+[SYS_sigreturn] sys_sigreturn,
 };
 
 void
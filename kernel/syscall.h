@@ -25,3 +25,15 @@
 #define SYS_kthread_kill  24
 #define SYS_kthread_exit  25
 #define SYS_kthread_join  26
+#define SYS_vmstat  27
+#define SYS_vmtune  28
+#define SYS_mmap    29
+#define SYS_munmap  30
+#define SYS_shmget  31
+#define SYS_shmat   32
+#define SYS_shmdt   33
+#define SYS_meminfo 34
+#define SYS_faultstat 35
+#define SYS_poll    36
+#define SYS_sigalarm  37
+#define SYS_sigreturn 38
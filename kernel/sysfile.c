@@ -15,6 +15,9 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
+#include "memlayout.h"
+#include "poll.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -539,3 +542,354 @@ sys_pipe(void)
     }
     return 0;
 }
+
+// Address ranges that user memory must stay out of: the
+// devices, which user page tables share with the kernel, and
+// RAM, which a process's kernel page table maps at the same
+// addresses, under the same ASID, as the user's page table.
+static uint64 holes[][2] = {
+    {DEVBASE, DEVTOP},
+    {KERNBASE, PHYSTOP},
+};
+
+// Return the start of a hole that [a, a+len) overlaps,
+// or 0 if none.
+static uint64
+mmaphole(uint64 a, uint64 len)
+{
+    int i;
+
+    for (i = 0; i < NELEM(holes); i++)
+        if (a < holes[i][1] && holes[i][0] < a + len)
+            return holes[i][0];
+    return 0;
+}
+
+// Find len bytes of free address space for mmap(),
+// searching down from MMAPTOP, skipping the kernel's
+// holes. Returns 0 if there is none.
+// Caller holds p->vm_lock.
+static uint64
+mmapaddr(struct proc *p, uint64 len)
+{
+    struct vma *v;
+    uint64 a = MMAPTOP - len, h;
+
+again:
+    if ((h = mmaphole(a, len)) != 0)
+    {
+        if (h < len)
+            return 0;
+        a = h - len;
+        goto again;
+    }
+    for (v = p->vma; v < &p->vma[NVMA]; v++)
+    {
+        if (v->len && a < v->start + v->len && v->start < a + len)
+        {
+            if (v->start < len)
+                return 0;
+            a = v->start - len;
+            goto again;
+        }
+    }
+    if (a < PGROUNDUP(p->sz))
+        return 0;
+    return a;
+}
+
+// Is [a, a+len) unused by p's heap, mmap() regions and the kernel?
+// Caller holds p->vm_lock.
+static int
+mmapfree(struct proc *p, uint64 a, uint64 len)
+{
+    struct vma *v;
+
+    if (a % PGSIZE != 0 || a < PGROUNDUP(p->sz) || a + len < a || a + len > MMAPTOP)
+        return 0;
+    if (mmaphole(a, len))
+        return 0;
+    for (v = p->vma; v < &p->vma[NVMA]; v++)
+        if (v->len && a < v->start + v->len && v->start < a + len)
+            return 0;
+    return 1;
+}
+
+// Add a region of len bytes to p at addr, or wherever there
+// is room if addr is 0. Takes over the caller's references
+// to f and shm. Returns the region's address, or 0 if
+// there's no room.
+static uint64
+mmapadd(struct proc *p, uint64 addr, uint64 len, int prot, int flags,
+        struct file *f, struct shm *shm, uint64 off)
+{
+    struct vma *v, *nv = 0;
+
+    acquire(&p->vm_lock);
+    for (v = p->vma; v < &p->vma[NVMA]; v++)
+    {
+        if (v->len == 0)
+        {
+            nv = v;
+            break;
+        }
+    }
+    if (addr)
+    {
+        if (!mmapfree(p, addr, len))
+            addr = 0;
+    }
+    else
+    {
+        addr = mmapaddr(p, len);
+    }
+    if (nv == 0 || addr == 0)
+    {
+        release(&p->vm_lock);
+        return 0;
+    }
+    nv->start = addr;
+    nv->len = len;
+    nv->prot = 0;
+    if (prot & (PROT_READ | PROT_WRITE))
+        nv->prot |= PTE_R; // risc-v has no write-only pages.
+    if (prot & PROT_WRITE)
+        nv->prot |= PTE_W;
+    if (prot & PROT_EXEC)
+        nv->prot |= PTE_X;
+    nv->flags = flags;
+    nv->f = f;
+    nv->shm = shm;
+    nv->off = off;
+    release(&p->vm_lock);
+    return addr;
+}
+
+// mmap(addr, len, prot, flags, fd, off): map len bytes of
+// anonymous memory, or of the file open as fd starting at
+// offset off. Pages are faulted in on first touch.
+uint64
+sys_mmap(void)
+{
+    uint64 addr, len, off;
+    int prot, flags;
+    struct file *f = 0;
+    struct shm *shm = 0;
+    struct proc *p = myproc();
+
+    argaddr(0, &addr);
+    argaddr(1, &len);
+    argint(2, &prot);
+    argint(3, &flags);
+    argaddr(5, &off);
+    if (len == 0 || len > MMAPTOP || off % PGSIZE != 0)
+        return -1;
+    if (((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+        return -1;
+    if ((flags & MAP_FIXED) == 0)
+        addr = 0;
+    else if (addr == 0)
+        return -1;
+    if ((flags & MAP_ANONYMOUS) == 0)
+    {
+        if (argfd(4, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+            return -1;
+        if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+            return -1;
+        // processes sharing a file share its pages, through
+        // an shm object that the inode points to.
+        if ((flags & MAP_SHARED) && (shm = shmfile(f->ip)) == 0)
+            return -1;
+        filedup(f);
+    }
+    else if (flags & MAP_SHARED)
+    {
+        // shared anonymous memory lives in an shm object, so
+        // that a fork()ed child finds the same pages.
+        if ((shm = shmanon(len)) == 0)
+            return -1;
+        off = 0;
+    }
+    len = PGROUNDUP(len);
+
+    if ((addr = mmapadd(p, addr, len, prot, flags, f, shm, off)) == 0)
+    {
+        if (shm)
+            shmput(shm);
+        if (f)
+            fileclose(f);
+        return -1;
+    }
+    return addr;
+}
+
+// Remove p's mappings of the pages in [addr, addr+len),
+// shrinking or splitting the regions they belong to.
+static int
+munmap(struct proc *p, uint64 addr, uint64 len)
+{
+    uint64 s, e;
+    struct vma *v, *nv, old;
+    int freed;
+
+    for (v = p->vma; v < &p->vma[NVMA]; v++)
+    {
+        acquire(&p->vm_lock);
+        if (v->len == 0 || addr >= v->start + v->len || v->start >= addr + len)
+        {
+            release(&p->vm_lock);
+            continue;
+        }
+        old = *v;
+        s = addr > v->start ? addr : v->start;
+        e = addr + len < v->start + v->len ? addr + len : v->start + v->len;
+        freed = 0;
+        if (s == v->start && e == v->start + v->len)
+        {
+            v->start = v->len = 0;
+            v->f = 0;
+            v->shm = 0;
+            freed = 1;
+        }
+        else if (s == v->start)
+        {
+            v->off += e - v->start;
+            v->len -= e - v->start;
+            v->start = e;
+        }
+        else if (e == v->start + v->len)
+        {
+            v->len = s - v->start;
+        }
+        else
+        {
+            // a hole in the middle splits the region in two.
+            for (nv = p->vma; nv < &p->vma[NVMA] && nv->len; nv++)
+                ;
+            if (nv == &p->vma[NVMA])
+            {
+                release(&p->vm_lock);
+                return -1;
+            }
+            *nv = *v;
+            nv->start = e;
+            nv->len = v->start + v->len - e;
+            nv->off = v->off + (e - v->start);
+            if (nv->f)
+                filedup(nv->f);
+            if (nv->shm)
+                shmdup(nv->shm);
+            v->len = s - v->start;
+        }
+        release(&p->vm_lock);
+
+        vmaunmap(p, &old, s, e - s);
+        if (freed && old.shm)
+            shmput(old.shm);
+        if (freed && old.f)
+            fileclose(old.f);
+    }
+    return 0;
+}
+
+// munmap(addr, len): remove the mappings of the pages in
+// [addr, addr+len), writing modified pages of shared file
+// mappings back to the file. Regions may shrink or split.
+uint64
+sys_munmap(void)
+{
+    uint64 addr, len;
+
+    argaddr(0, &addr);
+    argaddr(1, &len);
+    if (addr % PGSIZE != 0 || len == 0 || addr + len < addr)
+        return -1;
+    return munmap(myproc(), addr, PGROUNDUP(len));
+}
+
+// shmget(key, size): return the id of the shared memory
+// segment named key (a positive number), creating it with
+// room for size bytes if there is none yet. A segment lives
+// until its last attachment goes away, or, if it is never
+// attached, until the process that created it exits.
+uint64
+sys_shmget(void)
+{
+    int key;
+    uint64 size;
+
+    argint(0, &key);
+    argaddr(1, &size);
+    if (key <= 0)
+        return -1;
+    return shmget(key, size);
+}
+
+// shmat(id): map all of segment id read/write, and return
+// its address. The mapping is an ordinary MAP_SHARED region,
+// inherited by fork() and removed by munmap() or shmdt().
+uint64
+sys_shmat(void)
+{
+    int id;
+    uint64 addr;
+    struct shm *shm;
+
+    argint(0, &id);
+    if ((shm = shmattach(id)) == 0)
+        return -1;
+    addr = mmapadd(myproc(), 0, shmsize(shm), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, 0, shm, 0);
+    if (addr == 0)
+    {
+        shmput(shm);
+        return -1;
+    }
+    return addr;
+}
+
+// shmdt(addr): remove the segment mapping that shmat()
+// returned at addr.
+uint64
+sys_shmdt(void)
+{
+    uint64 addr, len = 0;
+    struct proc *p = myproc();
+    struct vma *v;
+
+    argaddr(0, &addr);
+    acquire(&p->vm_lock);
+    for (v = p->vma; v < &p->vma[NVMA]; v++)
+        if (v->len && v->start == addr && v->shm && v->f == 0)
+            len = v->len;
+    release(&p->vm_lock);
+    if (len == 0)
+        return -1;
+    return munmap(p, addr, len);
+}
+
+// poll(fds, n, timeout): wait until one of the n files in
+// fds can do the I/O it asks about without blocking, or for
+// timeout ticks; a negative timeout waits for ever, and 0
+// doesn't wait. Returns how many are ready.
+uint64
+sys_poll(void)
+{
+    struct pollfd fds[NPOLL];
+    uint64 addr;
+    int n, timeout, r;
+    struct proc *p = myproc();
+
+    argaddr(0, &addr);
+    argint(1, &n);
+    argint(2, &timeout);
+    if (n < 0 || n > NPOLL)
+        return -1;
+    if (copyin(p->pagetable, (char *)fds, addr, n * sizeof(fds[0])) < 0)
+        return -1;
+    if ((r = filepoll(fds, n, timeout)) < 0)
+        return -1;
+    if (copyout(p->pagetable, addr, (char *)fds, n * sizeof(fds[0])) < 0)
+        return -1;
+    return r;
+}
@@ -5,6 +5,8 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "vmstat.h"
+#include "meminfo.h"
 
 uint64
 sys_exit(void)
@@ -134,4 +136,116 @@ sys_kthread_join(void)
     argint(0, &tid);
     argaddr(1, &status);
     return kthread_join(tid, (int*) status);
-}
\ No newline at end of file
+}
+// call handler every ticks timer ticks that the calling
+// kthread spends running in user space, or stop if ticks is 0.
+uint64
+sys_sigalarm(void)
+{
+    struct kthread *kt = mykthread();
+    uint64 handler;
+    int n;
+
+    argint(0, &n);
+    argaddr(1, &handler);
+    if (n < 0)
+        return -1;
+    kt->alarmticks = n;
+    kt->alarmleft = n;
+    kt->alarmhandler = handler;
+    return 0;
+}
+
+// return from a sigalarm() handler to the interrupted code,
+// restoring the user registers alarmupcall() saved at frame.
+// tp stays as it is: it belongs to the kthread, and the
+// handler may have moved the code it interrupted to another.
+uint64
+sys_sigreturn(void)
+{
+    struct trapframe *tf = mykthread()->trapframe;
+    struct trapframe saved;
+    uint64 frame;
+
+    argaddr(0, &frame);
+    if (copyin(myproc()->pagetable, (char *)&saved, frame, sizeof(saved)) < 0)
+        return -1;
+    saved.tp = tf->tp;
+    tf->epc = saved.epc;
+    memmove(&tf->ra, &saved.ra, (char *)(tf + 1) - (char *)&tf->ra);
+    return tf->a0; // syscall() stores this back in a0
+}
+
+uint64
+sys_vmstat(void)
+{
+    uint64 addr;
+    argaddr(0, &addr);
+    return copyout(myproc()->pagetable, addr, (char *)&vmstat, sizeof(vmstat));
+}
+
+// copy physical memory usage to the user's struct meminfo.
+uint64
+sys_meminfo(void)
+{
+    struct meminfo *mi;
+    uint64 addr;
+    int r;
+
+    argaddr(0, &addr);
+    // too big for the kernel stack.
+    if ((mi = (struct meminfo *)kalloc()) == 0)
+        return -1;
+    meminfo(mi);
+    r = copyout(myproc()->pagetable, addr, (char *)mi, sizeof(*mi));
+    kfree(mi);
+    return r;
+}
+
+// copy page fault counters for a process, or for the
+// whole system if pid is 0, to the user's struct faultstat.
+uint64
+sys_faultstat(void)
+{
+    uint64 addr;
+    int pid;
+
+    argint(0, &pid);
+    argaddr(1, &addr);
+    return faultstat(pid, addr);
+}
+
+// set a virtual memory knob from vmstat.h to value,
+// unless value is negative. returns the old setting.
+uint64
+sys_vmtune(void)
+{
+    int knob, value, old;
+
+    argint(0, &knob);
+    argint(1, &value);
+    switch (knob)
+    {
+    case VM_LAZYEXEC:
+        old = lazyexec;
+        if (value >= 0)
+            lazyexec = value != 0;
+        return old;
+    case VM_SUPERPAGES:
+        old = superpages;
+        if (value >= 0)
+            superpages = value != 0;
+        return old;
+    case VM_ZRAM:
+        old = zram;
+        if (value >= 0)
+            zram = value != 0;
+        return old;
+    case VM_FAULTLOG:
+        old = faultlog;
+        if (value >= 0)
+            faultlog = value != 0;
+        return old;
+    }
+    return -1;
+}
@@ -44,6 +44,8 @@ void usertrap(void)
 
     struct proc *p = myproc();
     struct kthread *kt = mykthread();
+    // pick up a new ASID that a sibling kthread gave p.
+    switchuvm(p);
     // save user program counter.
     kt->trapframe->epc = r_sepc();
 
@@ -72,6 +74,22 @@ void usertrap(void)
     {
         // ok
     }
+    else if (r_scause() == 12 || r_scause() == 13 || r_scause() == 15)
+    {
+        // page fault: demand-load an executable page or
+        // allocate a lazy heap page. loading may sleep, so
+        // take the fault details before enabling interrupts.
+        uint64 va = r_stval();
+        uint64 scause = r_scause();
+        int access = scause == 12 ? PTE_X : (scause == 13 ? PTE_R : PTE_W);
+        intr_on();
+        if (uvmfault(p, va, access) < 0)
+        {
+            printf("usertrap(): unexpected scause %p pid=%d\n", scause, p->pid);
+            printf("            sepc=%p stval=%p\n", kt->trapframe->epc, va);
+            setkilled(p);
+        }
+    }
     else
     {
         printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
@@ -86,13 +104,45 @@ void usertrap(void)
     }
     if (kthread_killed(kt))
         exit(-1);
-    // give up the CPU if this is a timer interrupt.
+    // give up the CPU if this is a timer interrupt, and
+    // make the sigalarm() upcall if it is due.
     if (which_dev == 2)
+    {
+        if (kt->alarmticks > 0 && --kt->alarmleft <= 0)
+        {
+            kt->alarmleft = kt->alarmticks;
+            intr_on(); // copying to the stack may fault a page in
+            alarmupcall(kt);
+        }
         yield();
+    }
 
     usertrapret();
 }
 
+// Make kt return to user space in its sigalarm() handler,
+// with the interrupted user registers saved in a struct
+// trapframe pushed on its user stack, and a pointer to them
+// as the argument, for sigreturn().
+void alarmupcall(struct kthread *kt)
+{
+    struct proc *p = kt->my_pcb;
+    struct trapframe *tf = kt->trapframe;
+    uint64 frame;
+
+    frame = (tf->sp - sizeof(*tf)) & ~15L;
+    if (copyout(p->pagetable, frame, (char *)tf, sizeof(*tf)) < 0)
+    {
+        printf("alarmupcall: bad stack pid=%d sp=%p\n", p->pid, tf->sp);
+        setkilled(p);
+        return;
+    }
+    tf->epc = kt->alarmhandler;
+    tf->sp = frame;
+    tf->a0 = frame;
+    tf->ra = 0; // the handler mustn't return
+}
+
 //
 // return to user space
 //
@@ -110,6 +160,9 @@ void usertrapret(void)
     uint64 trampoline_uservec = TRAMPOLINE + (uservec - trampoline);
     w_stvec(trampoline_uservec);
 
+    // make sure this hart is on p's current ASID.
+    switchuvm(p);
+
     // set up trapframe values that uservec will need when
     // the process next traps into the kernel.
     kt->trapframe->kernel_satp = r_satp();          // kernel page table
@@ -130,7 +183,9 @@ void usertrapret(void)
     w_sepc(kt->trapframe->epc);
 
     // tell trampoline.S the user page table to switch to.
-    uint64 satp = MAKE_SATP(p->pagetable);
+    // it shares p's ASID with the kernel page table, so
+    // switching between them needs no TLB flush.
+    uint64 satp = MAKE_SATP_ASID(p->pagetable, p->asid);
 
     // jump to userret in trampoline.S at the top of memory, which
     // switches to the user page table, restores user registers,
@@ -153,6 +208,16 @@ void kerneltrap()
     if (intr_get() != 0)
         panic("kerneltrap: interrupts enabled");
 
+    if ((scause == 13 || scause == 15) &&
+        sepc >= (uint64)copyuser_start && sepc < (uint64)copyuser_end)
+    {
+        // a direct copy to or from user memory hit a page that
+        // isn't mapped (or is read-only); make it fail, so that
+        // the caller can fault the page in properly.
+        w_sepc((uint64)copyuser_fault);
+        return;
+    }
+
     if ((which_dev = devintr()) == 0)
     {
         printf("scause %p\n", scause);
@@ -161,8 +226,15 @@ void kerneltrap()
     }
 
     // give up the CPU if this is a timer interrupt.
+    // an interrupted direct copy's SUM stays with it, rather
+    // than with whatever runs next on this CPU.
     if (which_dev == 2 && mykthread() != 0 && mykthread()->state == RUNNING)
+    {
+        w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+        mykthread()->kpreempted = 1;
         yield();
+        mykthread()->kpreempted = 0;
+    }
 
     // the yield() may have caused some traps to occur,
     // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -176,6 +248,7 @@ void clockintr()
     ticks++;
     wakeup(&ticks);
     release(&tickslock);
+    pollwakeup();
 }
 
 // check if it's an external interrupt or software interrupt,
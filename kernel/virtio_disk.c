@@ -212,6 +212,17 @@ alloc3_desc(int *idx)
   return 0;
 }
 
+// the size of the disk in blocks, from the capacity
+// (in 512-byte sectors) in the device's configuration.
+uint64
+virtio_disk_size(void)
+{
+  uint64 sectors;
+
+  sectors = *R(VIRTIO_MMIO_CONFIG) | ((uint64)*R(VIRTIO_MMIO_CONFIG + 4) << 32);
+  return sectors / (BSIZE / 512);
+}
+
 void
 virtio_disk_rw(struct buf *b, int write)
 {
@@ -3,14 +3,31 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "mman.h"
+#include "vmstat.h"
+#include "meminfo.h"
+#include "fault.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
 
+// a page of zeros, mapped read-only into every lazily grown
+// heap page that has been read but not yet written.
+char *zeropage;
+
+struct vmstat vmstat;
+
+// back aligned 2 MB blocks of the heap with superpages.
+int superpages = 1;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
@@ -37,6 +54,7 @@ kvmmake(void)
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // mappages() uses superpages from the first 2 MB boundary.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -49,11 +67,44 @@ kvmmake(void)
   return kpgtbl;
 }
 
+// Make a kernel page table for a process whose user page
+// table is pagetable: the kernel's own mappings, except that
+// the first level-1 page-table page is the user's, which
+// holds the kernel's device mappings too (see uvmcreate()).
+// While the process runs on it, the kernel can reach user
+// memory below DEVBASE at its user addresses, with SUM set.
+// Returns 0 if out of memory.
+pagetable_t
+kvmcreate(pagetable_t pagetable)
+{
+  pagetable_t kpgtbl;
+
+  if((kpgtbl = (pagetable_t)kalloc()) == 0)
+    return 0;
+  memmove(kpgtbl, kernel_pagetable, PGSIZE);
+  kpgtbl[0] = pagetable[0];
+  return kpgtbl;
+}
+
+// Point kernel page table kpgtbl, which this hart may be
+// using, at the new user page table pagetable, for exec().
+// The caller flushes the process's ASID.
+void
+kvmuser(pagetable_t kpgtbl, pagetable_t pagetable)
+{
+  kpgtbl[0] = pagetable[0];
+}
+
 // Initialize the one kernel_pagetable
 void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+
+  if((zeropage = kalloc()) == 0)
+    panic("kvminit: zeropage");
+  memset(zeropage, 0, PGSIZE);
+  initlock(&faultlock, "faults");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -70,9 +121,77 @@ kvminithart()
   sfence_vma();
 }
 
+// Switch this hart back to the kernel's page table, when
+// it stops running a process's kthreads. The scheduler runs
+// with interrupts on, but a trap on this hart doesn't care
+// which page table is installed, since the kernel's mappings
+// are in all of them. No flush is needed: the kernel's
+// mappings are global, and no process has ASID 0.
+void
+kvmswitch(void)
+{
+  struct cpu *c = mycpu();
+
+  w_satp(MAKE_SATP(kernel_pagetable));
+  // let freeproc() free the page table.
+  __atomic_store_n(&c->kpagetable, 0, __ATOMIC_RELEASE);
+}
+
+// Split the 2 MB superpage mapped by level-1 PTE pte into
+// 512 4 KB mappings of the same pages, in a new level-0
+// page-table page. Returns that page, or 0 if out of memory.
+// The translation is unchanged, so the TLB needn't be flushed.
+static pagetable_t
+demote(pte_t *pte)
+{
+  pagetable_t pagetable;
+  uint64 pa = PTE2PA(*pte);
+  int flags = PTE_FLAGS(*pte);
+
+  if((pagetable = (pagetable_t)kalloc()) == 0)
+    return 0;
+  for(int i = 0; i < 512; i++)
+    pagetable[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(pagetable) | PTE_V;
+  __sync_fetch_and_add(&vmstat.super_demotes, 1);
+  return pagetable;
+}
+
+// Return the address of the PTE at the given level (0 or 1)
+// of page table pagetable that corresponds to virtual address
+// va. If alloc!=0, create any required page-table pages, and
+// split a superpage above that level into 4 KB pages; if
+// not, there is no such PTE, and 0 is returned.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int to)
+{
+  if(va >= MAXVA)
+    panic("walk");
+
+  for(int level = 2; level > to; level--) {
+    pte_t *pte = &pagetable[PX(level, va)];
+    if((*pte & PTE_V) && (*pte & (PTE_R|PTE_W|PTE_X))) {
+      if(!alloc || level != 1 || (pagetable = demote(pte)) == 0)
+        return 0;
+    } else if(*pte & PTE_V) {
+      pagetable = (pagetable_t)PTE2PA(*pte);
+    } else {
+      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+        return 0;
+      memset(pagetable, 0, PGSIZE);
+      *pte = PA2PTE(pagetable) | PTE_V;
+    }
+  }
+  return &pagetable[PX(to, va)];
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page-table pages.
+// create any required page-table pages, and split a 2 MB
+// superpage that covers va into 4 KB pages, so va gets a
+// PTE of its own. Without alloc, walk() changes nothing,
+// and returns 0 for va in a superpage; walkleaf() finds
+// the PTE that maps it.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -82,24 +201,60 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+// A level-1 PTE with R, W or X set is a leaf that maps a
+// whole 2 MB superpage.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
+  return walklevel(pagetable, va, alloc, 0);
+}
+
+// Like walk() without alloc, but return the level-1 PTE of
+// a superpage that covers va rather than splitting it, and
+// set *super to say which kind of PTE was returned.
+pte_t *
+walkleaf(pagetable_t pagetable, uint64 va, int *super)
+{
+  pte_t *pte;
+
   if(va >= MAXVA)
-    panic("walk");
+    panic("walkleaf");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
-    if(*pte & PTE_V) {
-      pagetable = (pagetable_t)PTE2PA(*pte);
-    } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
-        return 0;
-      memset(pagetable, 0, PGSIZE);
-      *pte = PA2PTE(pagetable) | PTE_V;
-    }
+  *super = 0;
+  pte = &pagetable[PX(2, va)];
+  if((*pte & PTE_V) == 0)
+    return 0;
+  pte = &((pagetable_t)PTE2PA(*pte))[PX(1, va)];
+  if((*pte & PTE_V) == 0)
+    return 0;
+  if(*pte & (PTE_R|PTE_W|PTE_X)){
+    *super = 1;
+    return pte;
   }
-  return &pagetable[PX(0, va)];
+  return &((pagetable_t)PTE2PA(*pte))[PX(0, va)];
+}
+
+// Split the superpage that covers va, if any, unless va is
+// where it starts, so that the pages below va and from it
+// can be unmapped apart. Returns 0, or -1 if out of memory.
+int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  int super;
+
+  if(va % SUPERPGSIZE == 0 || walkleaf(pagetable, va, &super) == 0 || !super)
+    return 0;
+  return walk(pagetable, va, 1) ? 0 : -1;
+}
+
+// Return the physical address of page va, mapped by the
+// leaf PTE that walkleaf() returned.
+static uint64
+leafaddr(pte_t pte, uint64 va, int super)
+{
+  if(super)
+    return PTE2PA(pte) + (PGROUNDDOWN(va) - SUPERPGROUNDDOWN(va));
+  return PTE2PA(pte);
 }
 
 // Look up a virtual address, return the physical address,
@@ -109,40 +264,45 @@ uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
-  uint64 pa;
+  int super;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walkleaf(pagetable, va, &super);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
-  return pa;
+  if((*pte & PTE_R) == 0)
+    return 0;  // the stack guard page; see uvmclear().
+  return leafaddr(*pte, va, super);
 }
 
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// kernel mappings are global, so their TLB entries
+// survive switches between processes' ASIDs.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
+  if(mappages(kpgtbl, va, sz, pa, perm | PTE_G) != 0)
     panic("kvmmap");
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Wherever va and pa are both 2 MB-aligned
+// and at least 2 MB remain, a superpage is mapped instead of
+// 512 pages. Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  uint64 a, last, n;
   pte_t *pte;
 
   if(size == 0)
@@ -151,56 +311,113 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    n = PGSIZE;
+    if(a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 &&
+       last - a >= SUPERPGSIZE - PGSIZE){
+      if((pte = walklevel(pagetable, a, 1, 1)) == 0)
+        return -1;
+      if(*pte == 0)
+        n = SUPERPGSIZE;
+    }
+    if(n == PGSIZE && (pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
+    if(a + n - PGSIZE == last)
       break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += n;
+    pa += n;
   }
   return 0;
 }
 
+// pages uvmreaper() has unmapped, handed back to kalloc a
+// batch at a time. only the reaper uses them.
+static void *reapbatch[REAPBATCH];
+static int nreapbatch;
+
+// Free user page pa, or add it to the reaper's batch if
+// do_free is 2.
+static void
+freepage(void *pa, int do_free)
+{
+  if(do_free != 2){
+    kfree(pa);
+    return;
+  }
+  reapbatch[nreapbatch++] = pa;
+  if(nreapbatch == REAPBATCH){
+    kfreebatch(reapbatch, nreapbatch);
+    nreapbatch = 0;
+  }
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
+// page-aligned. Pages of a lazily grown heap that were never
+// touched have no mapping and are skipped. A superpage only
+// partly in the range must have been split by uvmsplit().
+// Optionally free the physical memory, and swap slots of
+// pages that were swapped out; do_free 2 is for uvmreaper().
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end = va + npages*PGSIZE;
   pte_t *pte;
+  int super;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+  for(a = va; a < end; a += PGSIZE){
+    if((pte = walkleaf(pagetable, a, &super)) == 0)
+      continue;
+    if(*pte & PTE_SWAP){
+      if(do_free)
+        swapput(PTE2SLOT(*pte));
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
+    if(super && a % SUPERPGSIZE == 0 && a + SUPERPGSIZE <= end){
+      if(do_free)
+        ksuperfree((void*)PTE2PA(*pte));
+      *pte = 0;
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    if(super)
+      panic("uvmunmap: part of a superpage");
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
       uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+      if(pa != (uint64)zeropage)
+        freepage((void*)pa, do_free);
     }
     *pte = 0;
   }
 }
 
-// create an empty user page table.
+// create an empty user page table, whose first level-1
+// page-table page starts out with the kernel's device
+// mappings, for kvmcreate().
 // returns 0 if out of memory.
 pagetable_t
 uvmcreate()
 {
-  pagetable_t pagetable;
+  pagetable_t pagetable, l1;
   pagetable = (pagetable_t) kalloc();
   if(pagetable == 0)
     return 0;
   memset(pagetable, 0, PGSIZE);
+  if((l1 = (pagetable_t) kalloc()) == 0){
+    kfree(pagetable);
+    return 0;
+  }
+  memmove(l1, (void*)PTE2PA(kernel_pagetable[0]), PGSIZE);
+  pagetable[0] = PA2PTE(l1) | PTE_V;
   return pagetable;
 }
 
@@ -266,6 +483,25 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   return newsz;
 }
 
+// Count the npages pages from va that sbrk() reserved and
+// no write fault has given a page of their own: unmapped,
+// or the zero page. Pages of a superpage were allocated.
+uint64
+uvmuntouched(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  uint64 a, n = 0;
+  pte_t *pte;
+  int super;
+
+  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    pte = walkleaf(pagetable, a, &super);
+    if(pte == 0 || (*pte & (PTE_V|PTE_SWAP)) == 0 ||
+       ((*pte & PTE_V) && PTE2PA(*pte) == (uint64)zeropage))
+      n++;
+  }
+  return n;
+}
+
 // Recursively free page-table pages.
 // All leaf mappings must already have been removed.
 void
@@ -287,19 +523,197 @@ freewalk(pagetable_t pagetable)
 }
 
 // Free user memory pages,
-// then free page-table pages.
-void
-uvmfree(pagetable_t pagetable, uint64 sz)
+// then free page-table pages, leaving alone the kernel's
+// device mappings that uvmcreate() put in.
+static void
+uvmfree1(pagetable_t pagetable, uint64 sz, int do_free)
 {
+  pagetable_t l1 = (pagetable_t)PTE2PA(pagetable[0]);
+  pagetable_t kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+
   if(sz > 0)
-    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, do_free);
+  for(int i = 0; i < 512; i++)
+    if(kl1[i])
+      l1[i] = 0;
   freewalk(pagetable);
 }
 
+void
+uvmfree(pagetable_t pagetable, uint64 sz)
+{
+  uvmfree1(pagetable, sz, 1);
+}
+
+// Address spaces of exited processes, and the old ones that
+// exec() replaced, wait here for uvmreaper() to free them,
+// so that wait() and exec() needn't take time proportional
+// to the memory freed.
+struct deadmm {
+  pagetable_t pagetable;
+  uint64 sz;
+  struct deadmm *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct deadmm mm[NPROC];
+  struct deadmm *free;    // unused entries
+  struct deadmm *head;    // waiting to be freed
+  int pending;            // waiting or being freed
+  struct kthread *kt;     // the reaper
+} reap;
+
+void
+reapinit(void)
+{
+  struct deadmm *d;
+
+  initlock(&reap.lock, "reap");
+  for(d = reap.mm; d < &reap.mm[NPROC]; d++){
+    d->next = reap.free;
+    reap.free = d;
+  }
+}
+
+// Like uvmfree(), but leave the work to uvmreaper(), unless
+// too many address spaces are already waiting. Never sleeps,
+// and takes no process's lock, so may be called holding one.
+void
+uvmfreelater(pagetable_t pagetable, uint64 sz)
+{
+  struct deadmm *d;
+  struct kthread *kt;
+
+  acquire(&reap.lock);
+  if((d = reap.free) == 0){
+    release(&reap.lock);
+    uvmfree(pagetable, sz);
+    return;
+  }
+  reap.free = d->next;
+  d->pagetable = pagetable;
+  d->sz = sz;
+  d->next = reap.head;
+  reap.head = d;
+  reap.pending++;
+  kt = reap.kt;
+  release(&reap.lock);
+  if(kt)
+    wakeupkt(kt, &reap.head);
+}
+
+// Wait for the address spaces waiting to be freed, if any,
+// for a caller that ran out of memory. Returns 1 if there
+// were some, 0 if not.
+int
+uvmreapwait(void)
+{
+  int r;
+
+  acquire(&reap.lock);
+  r = reap.pending > 0;
+  while(reap.pending > 0)
+    sleep(&reap.pending, &reap.lock);
+  release(&reap.lock);
+  return r;
+}
+
+// The reaper, a kernel process started by main(): free the
+// address spaces uvmfreelater() queues, handing their pages
+// back to kalloc in batches.
+void
+uvmreaper(void)
+{
+  struct deadmm *d, *next;
+  int n;
+
+  // still holding the kthread's lock from scheduler().
+  release(&mykthread()->lock);
+
+  acquire(&reap.lock);
+  reap.kt = mykthread();
+  for(;;){
+    while(reap.head == 0)
+      sleep(&reap.head, &reap.lock);
+    d = reap.head;
+    reap.head = 0;
+    release(&reap.lock);
+
+    for(n = 0; d; d = next, n++){
+      next = d->next;
+      uvmfree1(d->pagetable, d->sz, 2);
+      acquire(&reap.lock);
+      d->next = reap.free;
+      reap.free = d;
+      release(&reap.lock);
+    }
+    kfreebatch(reapbatch, nreapbatch);
+    nreapbatch = 0;
+    __sync_fetch_and_add(&vmstat.reaped, n);
+
+    acquire(&reap.lock);
+    reap.pending -= n;
+    release(&reap.lock);
+    wakeup(&reap.pending);
+    acquire(&reap.lock);
+  }
+}
+
+// Add to m the page-table pages of pt, at the given level,
+// and the user pages it maps and has in swap. Entries that
+// skip[] has too are the kernel's, and left out. Every valid
+// level-0 PTE is a leaf, even the stack guard page's, which
+// has no R, W or X.
+static void
+ptcount(pagetable_t pt, int level, pagetable_t skip, struct procmem *m)
+{
+  pagetable_t kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+  pte_t pte;
+
+  m->ptpages++;
+  for(int i = 0; i < 512; i++){
+    pte = pt[i];
+    if(skip && skip[i])
+      continue;
+    if(pte & PTE_SWAP){
+      m->swapped++;
+    } else if((pte & PTE_V) == 0){
+    } else if(level == 0 || (pte & (PTE_R|PTE_W|PTE_X))){
+      if(pte & PTE_U)
+        m->rss += 1L << (9 * level);
+    } else {
+      ptcount((pagetable_t)PTE2PA(pte), level - 1,
+              level == 2 && i == 0 && pt != kernel_pagetable ? kl1 : 0, m);
+    }
+  }
+}
+
+// Count, for meminfo(), the user pages user page table
+// pagetable maps and has in swap, and its page-table pages.
+// Caller holds the process's vm_lock.
+void
+uvmcount(pagetable_t pagetable, struct procmem *m)
+{
+  ptcount(pagetable, 2, 0, m);
+}
+
+// Return the number of the kernel's page-table pages.
+uint64
+kvmcount(void)
+{
+  struct procmem m;
+
+  m.ptpages = m.rss = m.swapped = 0;
+  ptcount(kernel_pagetable, 2, 0, &m);
+  return m.ptpages;
+}
+
 // Given a parent process's page table, copy
 // its memory into a child's page table.
 // Copies both the page table and the
-// physical memory.
+// physical memory. Swapped-out pages stay in swap, shared
+// by both.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -309,14 +723,40 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   uint64 pa, i;
   uint flags;
   char *mem;
+  int super;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+    if((pte = walkleaf(old, i, &super)) == 0)
+      continue;
+    if(*pte & PTE_SWAP){
+      pte_t *npte;
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      swapdup(PTE2SLOT(*pte));
+      *npte = *pte;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
+      continue;
+    pa = leafaddr(*pte, i, super);
     flags = PTE_FLAGS(*pte);
+    if(super && i % SUPERPGSIZE == 0 && (mem = ksuperalloc()) != 0){
+      // copy a superpage whole if there's one free, else
+      // page by page.
+      memmove(mem, (char*)pa, SUPERPGSIZE);
+      if(mappages(new, i, SUPERPGSIZE, (uint64)mem, flags) != 0){
+        ksuperfree(mem);
+        goto err;
+      }
+      i += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    if(pa == (uint64)zeropage){
+      // still reads as zero; share the zero page.
+      if(mappages(new, i, PGSIZE, pa, flags) != 0)
+        goto err;
+      continue;
+    }
     if((mem = kalloc()) == 0)
       goto err;
     memmove(mem, (char*)pa, PGSIZE);
@@ -332,30 +772,690 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
-// mark a PTE invalid for user access.
-// used by exec for the user stack guard page.
+// mark a PTE inaccessible.
+// used by exec for the user stack guard page. the PTE stays
+// valid, so the heap fault handler leaves it alone, but
+// without R, W or X the hardware faults on any access, even
+// a kernel access to user memory with SUM set. At level 0
+// that is the encoding of a pointer to a page table, so code
+// that walks page tables must treat level 0 as leaves only,
+// and walkaddr() and uvmlookup() require R.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
+  int super;
   
-  pte = walk(pagetable, va, 0);
-  if(pte == 0)
+  pte = walkleaf(pagetable, va, &super);
+  if(pte == 0 || super)
     panic("uvmclear");
-  *pte &= ~PTE_U;
+  *pte &= ~(PTE_R|PTE_W|PTE_X);
+}
+
+// Load page va of ELF segment s from p's executable.
+// May sleep, so the caller must not hold any spinlocks.
+static int
+execfault(struct proc *p, struct execseg *s, uint64 va, int access, int *kind)
+{
+  struct inode *ip = p->execip;
+  pte_t *pte;
+  char *mem;
+  uint64 n, off;
+  int locked, r;
+
+  if((access & s->perm) != (access & (PTE_W|PTE_X)))
+    return -1;
+
+  acquire(&p->vm_lock);
+  pte = walk(p->pagetable, va, 0);
+  r = pte != 0 && (*pte & (PTE_V|PTE_SWAP));
+  release(&p->vm_lock);
+  if(r)
+    return 0;  // a sibling kthread loaded it first.
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  *kind = FAULT_ZERO;
+  if(va - s->vaddr < s->filesz){
+    n = s->filesz - (va - s->vaddr);
+    if(n > PGSIZE)
+      n = PGSIZE;
+    off = s->off + (va - s->vaddr);
+    // a read() of the executable itself faults here with
+    // the inode already locked by this kthread; a sibling
+    // holding it is waited for like anyone else.
+    locked = holdingsleep(&ip->lock);
+    if(!locked)
+      ilock(ip);
+    r = readi(ip, 0, (uint64)mem, off, n);
+    if(!locked)
+      iunlock(ip);
+    if(r != n){
+      kfree(mem);
+      return -1;
+    }
+    __sync_fetch_and_add(&vmstat.exec_loads, 1);
+    *kind = FAULT_FILE;
+  }
+
+  acquire(&p->vm_lock);
+  if((pte = walk(p->pagetable, va, 1)) == 0){
+    release(&p->vm_lock);
+    kfree(mem);
+    return -1;
+  }
+  if(*pte & (PTE_V|PTE_SWAP)){
+    kfree(mem);
+    *kind = FAULT_MINOR;
+  } else {
+    *pte = PA2PTE(mem) | s->perm | PTE_R | PTE_U | PTE_V;
+  }
+  release(&p->vm_lock);
+  return 0;
+}
+
+// Map a zeroed superpage over the 2 MB block holding heap
+// address va, if the whole block lies in p's heap and has
+// never had anything mapped in it (it has no level-0
+// page-table page), for a write fault there. Caller holds
+// vm_lock.
+static int
+heapsuper(struct proc *p, uint64 va)
+{
+  uint64 a = SUPERPGROUNDDOWN(va);
+  struct execseg *s;
+  pte_t *pte;
+  char *mem;
+
+  if(!superpages || a + SUPERPGSIZE > p->sz)
+    return -1;
+  for(s = p->execseg; s < &p->execseg[p->nexecseg]; s++)
+    if(a < s->vaddr + s->memsz && s->vaddr < a + SUPERPGSIZE)
+      return -1;
+  if((pte = walklevel(p->pagetable, a, 1, 1)) == 0 || *pte != 0)
+    return -1;
+  if((mem = ksuperalloc()) == 0)
+    return -1;
+  memset(mem, 0, SUPERPGSIZE);
+  *pte = PA2PTE(mem) | PTE_R | PTE_W | PTE_U | PTE_V;
+  __sync_fetch_and_add(&vmstat.super_allocs, 1);
+  __sync_fetch_and_add(&vmstat.lazy_allocs, SUPERPGSIZE / PGSIZE);
+  return 0;
+}
+
+// Handle a page fault at va in p's lazily grown heap.
+// A read maps the shared zero page. A write in an untouched
+// 2 MB block maps a superpage if one is free, and otherwise
+// allocates a zeroed page, replacing the zero page if it
+// was mapped. A block that is only read never costs more
+// than the zero page, but once read it keeps 4 KB pages.
+static int
+heapfault(struct proc *p, uint64 va, int access, int *kind)
+{
+  pte_t *pte;
+  char *mem;
+  int r = -1, super;
+
+  if(access & PTE_X)
+    return -1;
+
+  acquire(&p->vm_lock);
+  pte = walkleaf(p->pagetable, va, &super);
+  if(pte && (*pte & PTE_V)){
+    if((*pte & (PTE_R|PTE_W|PTE_X)) == 0){
+      // the stack guard page.
+    } else if(PTE2PA(*pte) != (uint64)zeropage){
+      // a sibling kthread faulted it in first.
+      if((*pte & access) == access)
+        r = 0;
+    } else if(access == PTE_R){
+      r = 0;
+    } else if((mem = kalloc()) != 0){
+      memset(mem, 0, PGSIZE);
+      *pte = PA2PTE(mem) | PTE_FLAGS(*pte) | PTE_W;
+      asidflush(p, va);
+      __sync_fetch_and_add(&vmstat.lazy_allocs, 1);
+      *kind = FAULT_ZERO;
+      r = 0;
+    }
+  } else if(pte && (*pte & PTE_SWAP)){
+    // swapped out since uvmfault() looked; fault again.
+    r = 0;
+  } else if(access == PTE_W && heapsuper(p, va) == 0){
+    *kind = FAULT_ZERO;
+    r = 0;
+  } else if(access == PTE_R){
+    if(mappages(p->pagetable, va, PGSIZE, (uint64)zeropage, PTE_R|PTE_U) == 0){
+      __sync_fetch_and_add(&vmstat.zero_maps, 1);
+      *kind = FAULT_ZERO;
+      r = 0;
+    }
+  } else if((mem = kalloc()) != 0){
+    memset(mem, 0, PGSIZE);
+    if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) == 0){
+      __sync_fetch_and_add(&vmstat.lazy_allocs, 1);
+      *kind = FAULT_ZERO;
+      r = 0;
+    } else {
+      kfree(mem);
+    }
+  }
+  release(&p->vm_lock);
+  return r;
+}
+
+// Give a private copy of the copy-on-write page va, at
+// pte, to faulting process p, or just make it writable if
+// no other page table still shares it. Caller holds vm_lock.
+static int
+cowfault(struct proc *p, uint64 va, pte_t *pte)
+{
+  uint64 pa = PTE2PA(*pte);
+  uint flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  char *mem;
+
+  if(krefcount((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+  } else {
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | flags;
+    asidflush(p, va);
+    kfree((void*)pa);
+  }
+  return 0;
+}
+
+// Read the page at file offset off of an mmap()ed file
+// into a new page. For a MAP_SHARED region, shm is the
+// file's shm object, and the page is the one it has, or
+// becomes its page; either way with a reference for the
+// caller. May sleep.
+static char *
+vmaread(struct inode *ip, struct shm *shm, uint64 off)
+{
+  char *mem;
+  int locked;
+
+  // as in execfault(), a read() of the file into its own
+  // mapping faults here with this kthread holding the lock.
+  locked = holdingsleep(&ip->lock);
+  if(!locked)
+    ilock(ip);
+  if(shm && (mem = (char*)shmfilepage(ip, off / PGSIZE)) != 0)
+    goto out;
+  if((mem = kalloc()) == 0)
+    goto out;
+  memset(mem, 0, PGSIZE);
+  // bytes past the end of the file read as zero.
+  if(readi(ip, 0, (uint64)mem, off, PGSIZE) < 0){
+    kfree(mem);
+    mem = 0;
+  } else if(shm){
+    mem = (char*)shmset(shm, off / PGSIZE, mem);
+  }
+ out:
+  if(!locked)
+    iunlock(ip);
+  return mem;
+}
+
+// Handle a page fault at page va of mmap() region v.
+// Private anonymous pages map the zero page until written;
+// shared ones come from the region's shm object, and file
+// pages are read from the file, into the file's shm object
+// for a shared mapping, so that every process mapping the
+// file maps the same page.
+// Pages of shared file mappings start out read-only, so the
+// first write marks them PTE_D for write-back by vmaunmap().
+static int
+vmafault(struct proc *p, struct vma *v, uint64 va, int access, int *kind)
+{
+  pte_t *pte;
+  char *mem = 0;
+  uint64 pa;
+  int perm = v->prot | PTE_U;
+  int r = -1, super;
+
+  if((v->prot & access) != access)
+    return -1;
+
+  if(v->f){
+    acquire(&p->vm_lock);
+    pte = walkleaf(p->pagetable, va, &super);
+    r = pte != 0 && (*pte & (PTE_V|PTE_SWAP));
+    release(&p->vm_lock);
+    if(!r && (mem = vmaread(v->f->ip, v->shm, v->off + (va - v->start))) == 0)
+      return -1;
+    r = -1;
+  }
+
+  acquire(&p->vm_lock);
+  if((pte = walk(p->pagetable, va, 1)) == 0)
+    goto out;
+  if(*pte & PTE_SWAP){
+    // swapped out since uvmfault() looked; fault again.
+    r = 0;
+    goto out;
+  }
+  if(*pte & PTE_V){
+    if((*pte & access) == access){
+      r = 0;  // a sibling kthread faulted it in first.
+    } else if(access != PTE_W){
+    } else if(*pte & PTE_COW){
+      r = cowfault(p, va, pte);
+      *kind = FAULT_COW;
+    } else if(PTE2PA(*pte) == (uint64)zeropage){
+      char *zmem;
+      if((zmem = kalloc()) != 0){
+        memset(zmem, 0, PGSIZE);
+        *pte = PA2PTE(zmem) | perm | PTE_V;
+        asidflush(p, va);
+        *kind = FAULT_ZERO;
+        r = 0;
+      }
+    } else if((v->flags & MAP_SHARED) && v->f){
+      *pte |= PTE_W | PTE_D;
+      r = 0;
+    }
+    goto out;
+  }
+
+  if(v->f && mem == 0){
+    // unmapped since we looked; let the access fault again.
+    r = 0;
+  } else if(v->f){
+    if((v->flags & MAP_SHARED) && access != PTE_W)
+      perm &= ~PTE_W;
+    else if(v->flags & MAP_SHARED)
+      perm |= PTE_D;
+    *pte = PA2PTE(mem) | perm | PTE_V;
+    mem = 0;
+    *kind = FAULT_FILE;
+    r = 0;
+  } else if(v->shm){
+    if((pa = shmpage(v->shm, (v->off + (va - v->start)) / PGSIZE)) != 0){
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      r = 0;
+    }
+  } else if(access == PTE_R && (v->flags & MAP_PRIVATE)){
+    *pte = PA2PTE(zeropage) | PTE_R | PTE_U | PTE_V;
+    __sync_fetch_and_add(&vmstat.zero_maps, 1);
+    *kind = FAULT_ZERO;
+    r = 0;
+  } else if((mem = kalloc()) != 0){
+    memset(mem, 0, PGSIZE);
+    *pte = PA2PTE(mem) | perm | PTE_V;
+    mem = 0;
+    *kind = FAULT_ZERO;
+    r = 0;
+  }
+
+ out:
+  release(&p->vm_lock);
+  if(mem)
+    kfree(mem);
+  return r;
+}
+
+// Find the mmap() region of p containing va, and copy it
+// to *v. Returns 0 if found, -1 if not.
+static int
+vmalookup(struct proc *p, uint64 va, struct vma *v)
+{
+  struct vma *vp;
+  int r = -1;
+
+  acquire(&p->vm_lock);
+  for(vp = p->vma; vp < &p->vma[NVMA]; vp++){
+    if(vp->len && va >= vp->start && va < vp->start + vp->len){
+      *v = *vp;
+      r = 0;
+      break;
+    }
+  }
+  release(&p->vm_lock);
+  return r;
+}
+
+// Return the lowest address used by p's mmap() regions,
+// which the heap may not grow past any more than DEVBASE.
+// Caller holds vm_lock.
+uint64
+vmafloor(struct proc *p)
+{
+  struct vma *v;
+  uint64 floor = DEVBASE;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && v->start < floor)
+      floor = v->start;
+  return floor;
+}
+
+// Unmap the pages [va, va+len) of p's mmap() region v,
+// writing modified pages of a shared file mapping back to
+// the file. Leaves v itself alone. May sleep.
+void
+vmaunmap(struct proc *p, struct vma *v, uint64 va, uint64 len)
+{
+  uint64 a, pa, off;
+  pte_t *pte, flags;
+  struct inode *ip;
+  uint n;
+
+  for(a = va; a < va + len; a += PGSIZE){
+    acquire(&p->vm_lock);
+    pte = walk(p->pagetable, a, 0);
+    if(pte && (*pte & PTE_SWAP)){
+      // only private pages are swapped, so there's nothing
+      // to write back.
+      swapput(PTE2SLOT(*pte));
+      *pte = 0;
+    }
+    if(pte == 0 || (*pte & PTE_V) == 0){
+      release(&p->vm_lock);
+      continue;
+    }
+    pa = PTE2PA(*pte);
+    flags = PTE_FLAGS(*pte);
+    *pte = 0;
+    asidflush(p, a);
+    release(&p->vm_lock);
+
+    if(v->f && (v->flags & MAP_SHARED) && (flags & PTE_D)){
+      ip = v->f->ip;
+      off = v->off + (a - v->start);
+      begin_op();
+      ilock(ip);
+      if(off < ip->size){
+        n = ip->size - off;
+        if(n > PGSIZE)
+          n = PGSIZE;
+        writei(ip, 0, pa, off, n);
+      }
+      iunlock(ip);
+      end_op();
+    }
+    if(pa != (uint64)zeropage)
+      kfree((void*)pa);
+  }
+}
+
+// Unmap all of p's mmap() regions, on exit() or exec().
+void
+vmaunmapall(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    vmaunmap(p, v, v->start, v->len);
+    // the file's shm object goes before the file, whose
+    // inode points to it.
+    if(v->shm)
+      shmput(v->shm);
+    if(v->f)
+      fileclose(v->f);
+    v->start = v->len = 0;
+    v->f = 0;
+    v->shm = 0;
+  }
+}
+
+// Give child np the mmap() regions of p, for fork().
+// Shared regions map the same pages; untouched pages of
+// anonymous ones are found later through their shm object.
+// Private regions share their pages read-only, and copy
+// them on the first write, and their swapped-out pages.
+// Returns 0 on success, -1 on failure, having unmapped
+// whatever was mapped in np.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+  uint64 a, pa;
+  pte_t *pte;
+  uint flags;
+  int super;
+
+  acquire(&p->vm_lock);
+  for(v = p->vma, nv = np->vma; v < &p->vma[NVMA]; v++, nv++){
+    if(v->len == 0)
+      continue;
+    *nv = *v;
+    if(nv->f)
+      filedup(nv->f);
+    if(nv->shm)
+      shmdup(nv->shm);
+    for(a = v->start; a < v->start + v->len; a += PGSIZE){
+      // only the heap has superpages.
+      if((pte = walkleaf(p->pagetable, a, &super)) == 0 || super)
+        continue;
+      if(*pte & PTE_SWAP){
+        pte_t *npte;
+        if((npte = walk(np->pagetable, a, 1)) == 0)
+          goto err;
+        swapdup(PTE2SLOT(*pte));
+        *npte = *pte;
+        continue;
+      }
+      if((*pte & PTE_V) == 0)
+        continue;
+      pa = PTE2PA(*pte);
+      flags = PTE_FLAGS(*pte);
+      if((v->flags & MAP_PRIVATE) && (flags & PTE_W)){
+        flags = (flags & ~PTE_W) | PTE_COW;
+        *pte = PA2PTE(pa) | flags;
+      }
+      if(mappages(np->pagetable, a, PGSIZE, pa, flags) != 0)
+        goto err;
+      if(pa != (uint64)zeropage)
+        krefinc((void*)pa);
+    }
+  }
+  asidflushall(p);
+  release(&p->vm_lock);
+  return 0;
+
+ err:
+  asidflushall(p);
+  release(&p->vm_lock);
+  for(nv = np->vma; nv < &np->vma[NVMA]; nv++){
+    if(nv->len == 0)
+      continue;
+    uvmunmap(np->pagetable, nv->start, nv->len / PGSIZE, 1);
+    if(nv->shm)
+      shmput(nv->shm);
+    if(nv->f)
+      fileclose(nv->f);
+    nv->start = nv->len = 0;
+    nv->f = 0;
+    nv->shm = 0;
+  }
+  return -1;
+}
+
+// Handle a page fault for uvmfault(), setting *kind to the
+// kind of fault it was. Reclaims memory first if it is low,
+// and again if the handler ran out.
+static int
+fault(struct proc *p, uint64 va, int access, int *kind)
+{
+  struct execseg *s;
+  struct vma v;
+  int r, tries = 0;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+ again:
+  reclaimlow();
+  if((r = swapin(p, va)) <= 0){
+    if(r < 0 && tries++ == 0 && (uvmreapwait() || reclaim(1) > 0))
+      goto again;
+    if(r == 0){
+      *kind = FAULT_SWAP;
+      sfence_vma_page(va, p->asid);
+    }
+    return r;
+  }
+  *kind = FAULT_MINOR;
+  if(vmalookup(p, va, &v) == 0){
+    r = vmafault(p, &v, va, access, kind);
+  } else if(va < p->sz){
+    for(s = p->execseg; s < &p->execseg[p->nexecseg]; s++)
+      if(va >= s->vaddr && va < s->vaddr + s->memsz)
+        break;
+    if(s < &p->execseg[p->nexecseg])
+      r = execfault(p, s, va, access, kind);
+    else
+      r = heapfault(p, va, access, kind);
+  } else {
+    return -1;
+  }
+  if(r < 0 && kfreepages() == 0 && tries++ == 0 &&
+     (uvmreapwait() || reclaim(1) > 0))
+    goto again;
+  // the handlers only widened access to va, or flushed it
+  // from every hart with asidflush(); drop whatever this
+  // hart's TLB still holds for it.
+  if(r == 0)
+    sfence_vma_page(va, p->asid);
+  return r;
+}
+
+// Page fault counters (see fault.h), and the log of recent
+// faults, if vmtune(VM_FAULTLOG) turned it on.
+struct faultstat faults;
+struct spinlock faultlock;
+int faultlog;
+
+// Count a fault of the given kind at va, which took t timer
+// cycles, for p and for the whole system.
+static void
+faultcount(struct proc *p, uint64 va, int kind, uint64 t)
+{
+  struct faultrec *f;
+  int b;
+
+  __sync_fetch_and_add(&p->faults[kind], 1);
+  __sync_fetch_and_add(&faults.count[kind], 1);
+  for(b = 0; b < NFAULTHIST - 1 && (t >> (b + 1)) != 0; b++)
+    ;
+  __sync_fetch_and_add(&faults.hist[kind][b], 1);
+
+  if(!faultlog)
+    return;
+  acquire(&faultlock);
+  f = &faults.log[faults.nlog++ % NFAULTLOG];
+  f->pid = p->pid;
+  f->kind = kind;
+  f->va = va;
+  f->epc = mykthread()->trapframe->epc;
+  f->time = t;
+  release(&faultlock);
+}
+
+// Handle a page fault at user address va that needed
+// access (PTE_R, PTE_W or PTE_X), by loading the page from
+// the executable or a mapped file, allocating it for the
+// heap or an anonymous mapping, reading it back from swap,
+// or copying a copy-on-write page, and count it. May sleep.
+// Returns 0 if the access can be retried, -1 if the address
+// is invalid or memory is exhausted.
+int
+uvmfault(struct proc *p, uint64 va, int access)
+{
+  uint64 t0 = r_time();
+  int r, kind = FAULT_BAD;
+
+  if((r = fault(p, va, access, &kind)) < 0)
+    kind = FAULT_BAD;
+  faultcount(p, va, kind, r_time() - t0);
+  return r;
+}
+
+// Look up the physical address of user page va0 for a
+// kernel copy, faulting the page in (or copying it, if it
+// is copy-on-write) as needed. Returns 0 if the page is not
+// accessible.
+static uint64
+uvmlookup(pagetable_t pagetable, uint64 va0, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  int super;
+
+  if(va0 >= MAXVA)
+    return 0;
+  for(int faulted = 0; ; faulted = 1){
+    pte = walkleaf(pagetable, va0, &super);
+    if(pte && (*pte & (PTE_V|PTE_U|PTE_R)) == (PTE_V|PTE_U|PTE_R) &&
+       (!write || (*pte & PTE_W))){
+      if(write)
+        *pte |= PTE_D;
+      return leafaddr(*pte, va0, super);
+    }
+    if(faulted || pagetable != p->pagetable ||
+       uvmfault(p, va0, write ? PTE_W : PTE_R) < 0)
+      return 0;
+  }
+}
+
+// Can the kernel reach user addresses [va, va+len) of page
+// table pagetable directly? Only those of the current process
+// below DEVBASE are in its kernel page table.
+static int
+direct(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+
+  return p != 0 && pagetable == p->pagetable &&
+    va + len >= va && va + len <= DEVBASE;
+}
+
+// Copy len bytes from src to user address dstva with a single
+// direct copy, if that needn't fault in any page. Never
+// sleeps, so spinlocks may be held. Returns 0 on success, -1
+// if the caller must use copyout() instead.
+int
+copyout_nofault(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
+{
+  if(!direct(pagetable, dstva, len))
+    return -1;
+  return copyuser((void*)dstva, src, len);
+}
+
+// Like copyout_nofault(), copying len bytes from user address
+// srcva to dst.
+int
+copyin_nofault(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
+{
+  if(!direct(pagetable, srcva, len))
+    return -1;
+  return copyuser(dst, (void*)srcva, len);
 }
 
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
+// Try a direct copy first; if a page has to be faulted in
+// (or dstva is bad) fall back to looking up each page.
 // Return 0 on success, -1 on error.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(copyout_nofault(pagetable, dstva, src, len) == 0)
+    return 0;
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmlookup(pagetable, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -372,15 +1472,18 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
 // Copy from user to kernel.
 // Copy len bytes to dst from virtual address srcva in a given page table.
+// Like copyout(), tries a direct copy first.
 // Return 0 on success, -1 on error.
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(copyin_nofault(pagetable, dst, srcva, len) == 0)
+    return 0;
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmlookup(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -405,9 +1508,18 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(direct(pagetable, srcva, max)){
+    switch(copyuserstr(dst, (char*)srcva, max)){
+    case 0:
+      return 0;
+    case 1:
+      return -1;  // no null within max bytes.
+    }
+  }
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmlookup(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -0,0 +1,35 @@
+// Virtual memory counters, returned by the vmstat() system call.
+struct vmstat {
+  uint64 lazy_pages;  // heap pages reserved by sbrk() without allocating
+  uint64 zero_maps;   // read faults satisfied by the shared zero page
+  uint64 lazy_allocs; // write faults that allocated a real page
+  uint64 exec_pages;  // ELF segment pages exec() left unloaded
+  uint64 exec_loads;  // ELF segment pages later faulted in
+  uint64 super_allocs;  // 2 MB heap blocks mapped with a superpage
+  uint64 super_demotes; // superpages split into 4 KB pages
+  uint64 samemm_switches; // kthread switches that kept the page table
+  uint64 migrations;    // kthreads run on a different hart than last time
+  uint64 reclaim_scanned;    // user pages looked at by reclaim()
+  uint64 reclaim_referenced; // of those, recently used ones spared
+  uint64 swap_outs;     // pages written to swap
+  uint64 swap_ins;      // pages read back from swap
+  uint64 swap_used;     // swap slots in use
+  uint64 swap_slots;    // swap slots on the disk
+  uint64 zram_stores;   // swapped-out pages kept compressed in RAM
+  uint64 zram_same;     // of those, pages of one repeated word
+  uint64 zram_rejects;  // pages that didn't compress, written to disk
+  uint64 zram_loads;    // swap-ins decompressed from RAM
+  uint64 zram_pages;    // pages held compressed now
+  uint64 zram_bytes;    // their compressed size
+  uint64 zram_pool;     // pages of RAM holding them
+  uint64 zram_in_time;  // timer cycles spent on swap-ins from RAM
+  uint64 disk_in_time;  // timer cycles spent on swap-ins from disk
+  uint64 reaped;        // address spaces freed by the reaper
+};
+
+// knobs for vmtune(knob, value).
+// a negative value only queries the current setting.
+#define VM_LAZYEXEC 1   // exec() pages segments in on demand
+#define VM_SUPERPAGES 2 // map 2 MB heap blocks with superpages
+#define VM_ZRAM 3       // keep swapped-out pages compressed in RAM
+#define VM_FAULTLOG 4   // log recent page faults; see fault.h
@@ -0,0 +1,215 @@
+// Compressed swap in RAM.
+//
+// Pages that reclaim() evicts still get swap slots, but
+// swapwrite() first tries to keep each one here, compressed
+// by lzcompress() into a pool of pages from kalloc(), and
+// writes only those that don't compress well to the disk.
+// A page that is one word repeated (most often all zeros)
+// takes no pool space at all.
+//
+// Each pool page is cut into 64 units of 64 bytes, with a
+// bitmap of the units in use. A compressed page takes a run
+// of units in one pool page, and a pool page is freed when
+// its last unit is.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "vmstat.h"
+
+#define UNIT 64
+#define NUNIT (PGSIZE / UNIT)     // one bit each in a uint64
+#define MAXLEN (PGSIZE * 3 / 4)   // keep pages that compress to this or less
+
+enum zstate { ZNONE, ZSAME, ZPOOL };
+
+struct zpage {
+  char *pa;     // the pool page, or 0
+  uint64 map;   // units in use
+};
+
+// what a swap slot holds, if it is here.
+struct zobj {
+  enum zstate state;
+  ushort page;  // ZPOOL: pool page,
+  uchar unit;   // first unit in it,
+  ushort len;   // and compressed length
+  uint64 fill;  // ZSAME: the word repeated
+};
+
+struct {
+  struct spinlock lock;
+  struct zpage page[NZPOOL];
+  struct zobj obj[NSWAP];   // by swap slot
+  int hint;                 // pool page to try first
+
+  // scratch space for one compression at a time.
+  struct sleeplock compressing;
+  ushort table[LZTABLE];
+  uchar buf[MAXLEN];
+} zpool;
+
+// vmtune(VM_ZRAM): keep swapped-out pages compressed in RAM.
+int zram = 1;
+
+void
+zraminit(void)
+{
+  initlock(&zpool.lock, "zram");
+  initsleeplock(&zpool.compressing, "zcompress");
+}
+
+// Return the first of n free units in map, or -1.
+static int
+zfit(uint64 map, int n)
+{
+  uint64 mask = (1UL << n) - 1;
+  int u;
+
+  for(u = 0; u + n <= NUNIT; u++)
+    if((map & (mask << u)) == 0)
+      return u;
+  return -1;
+}
+
+// Find n free units in a pool page, adding a page to the
+// pool if none has room. Returns the pool page, setting
+// *unit to the first unit, or -1 if out of memory.
+// Caller holds zpool.lock.
+static int
+zalloc(int n, int *unit)
+{
+  int i, pg, empty = -1;
+  char *pa;
+
+  for(i = 0; i < NZPOOL; i++){
+    pg = (zpool.hint + i) % NZPOOL;
+    if(zpool.page[pg].pa == 0){
+      if(empty < 0)
+        empty = pg;
+    } else if((*unit = zfit(zpool.page[pg].map, n)) >= 0){
+      zpool.hint = pg;
+      return pg;
+    }
+  }
+  if(empty < 0 || (pa = kalloc()) == 0)
+    return -1;
+  zpool.page[empty].pa = pa;
+  zpool.page[empty].map = 0;
+  zpool.hint = empty;
+  vmstat.zram_pool++;
+  *unit = 0;
+  return empty;
+}
+
+// Keep page pa, being swapped out to slot s, here if it
+// compresses well enough. Returns 0 if it was kept, -1 if
+// it must go to the disk. May sleep.
+int
+zramstore(int s, char *pa)
+{
+  struct zobj *o = &zpool.obj[s];
+  uint64 *w = (uint64*)pa;
+  int i, n, len, pg, unit;
+
+  if(!zram)
+    return -1;
+
+  for(i = 1; i < PGSIZE/8 && w[i] == w[0]; i++)
+    ;
+  if(i == PGSIZE/8){
+    acquire(&zpool.lock);
+    o->state = ZSAME;
+    o->fill = w[0];
+    vmstat.zram_stores++;
+    vmstat.zram_same++;
+    vmstat.zram_pages++;
+    release(&zpool.lock);
+    return 0;
+  }
+
+  acquiresleep(&zpool.compressing);
+  if((len = lzcompress((uchar*)pa, PGSIZE, zpool.buf, MAXLEN, zpool.table)) < 0){
+    releasesleep(&zpool.compressing);
+    __sync_fetch_and_add(&vmstat.zram_rejects, 1);
+    return -1;
+  }
+  n = (len + UNIT - 1) / UNIT;
+  acquire(&zpool.lock);
+  if((pg = zalloc(n, &unit)) < 0){
+    release(&zpool.lock);
+    releasesleep(&zpool.compressing);
+    __sync_fetch_and_add(&vmstat.zram_rejects, 1);
+    return -1;
+  }
+  zpool.page[pg].map |= ((1UL << n) - 1) << unit;
+  memmove(zpool.page[pg].pa + unit*UNIT, zpool.buf, len);
+  o->state = ZPOOL;
+  o->page = pg;
+  o->unit = unit;
+  o->len = len;
+  vmstat.zram_stores++;
+  vmstat.zram_pages++;
+  vmstat.zram_bytes += len;
+  release(&zpool.lock);
+  releasesleep(&zpool.compressing);
+  return 0;
+}
+
+// Read slot s into page pa if it is here. Returns 0 if it
+// was, -1 if it is on the disk. The caller holds a reference
+// to s, and s has been written, so it can't change.
+int
+zramload(int s, char *pa)
+{
+  struct zobj *o = &zpool.obj[s];
+  uint64 *w = (uint64*)pa;
+  int i;
+
+  switch(o->state){
+  case ZSAME:
+    for(i = 0; i < PGSIZE/8; i++)
+      w[i] = o->fill;
+    break;
+  case ZPOOL:
+    if(lzdecompress((uchar*)zpool.page[o->page].pa + o->unit*UNIT, o->len,
+                    (uchar*)pa, PGSIZE) != PGSIZE)
+      panic("zramload");
+    break;
+  default:
+    return -1;
+  }
+  __sync_fetch_and_add(&vmstat.zram_loads, 1);
+  return 0;
+}
+
+// Forget slot s, which is being freed, if it is here.
+void
+zramfree(int s)
+{
+  struct zobj *o = &zpool.obj[s];
+  struct zpage *zp;
+  int n;
+
+  acquire(&zpool.lock);
+  if(o->state == ZPOOL){
+    zp = &zpool.page[o->page];
+    n = (o->len + UNIT - 1) / UNIT;
+    zp->map &= ~(((1UL << n) - 1) << o->unit);
+    if(zp->map == 0){
+      kfree(zp->pa);
+      zp->pa = 0;
+      vmstat.zram_pool--;
+    }
+    vmstat.zram_bytes -= o->len;
+  }
+  if(o->state != ZNONE)
+    vmstat.zram_pages--;
+  o->state = ZNONE;
+  release(&zpool.lock);
+}
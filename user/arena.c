@@ -0,0 +1,94 @@
+// Arenas: allocate many small objects that are all freed at
+// once.
+//
+// arena_alloc() bumps a pointer through chunks got from
+// malloc(). arena_reset() frees everything allocated from an
+// arena by starting over at its first chunk, keeping the
+// chunks for the allocations that follow.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define ALIGN 16
+#define CHUNK (4096 - 32)   // default chunk size
+
+struct chunk {
+  struct chunk *next;
+  uint size;                // bytes after the header
+};
+
+struct arena {
+  struct chunk *chunks;     // in the order they are used
+  struct chunk *cur;        // being allocated from, or 0
+  char *next, *end;         // free space in cur
+  uint chunksize;
+};
+
+// Make an arena that gets memory chunksize bytes at a time,
+// or a default amount if chunksize is 0. Returns 0 if out of
+// memory.
+struct arena*
+arena_new(uint chunksize)
+{
+  struct arena *a;
+
+  if((a = malloc(sizeof(*a))) == 0)
+    return 0;
+  memset(a, 0, sizeof(*a));
+  a->chunksize = chunksize ? chunksize : CHUNK;
+  return a;
+}
+
+// Allocate n bytes from a, or return 0 if out of memory.
+void*
+arena_alloc(struct arena *a, uint n)
+{
+  struct chunk *c;
+  uint size;
+  char *p;
+
+  n = (n + ALIGN - 1) & ~(ALIGN - 1);
+  if(a->next + n > a->end){
+    c = a->cur ? a->cur->next : a->chunks;
+    if(c == 0 || c->size < n){
+      size = n > a->chunksize ? n : a->chunksize;
+      if((c = malloc(sizeof(*c) + size)) == 0)
+        return 0;
+      c->size = size;
+      if(a->cur){
+        c->next = a->cur->next;
+        a->cur->next = c;
+      } else {
+        c->next = a->chunks;
+        a->chunks = c;
+      }
+    }
+    a->cur = c;
+    a->next = (char*)(c + 1);
+    a->end = a->next + c->size;
+  }
+  p = a->next;
+  a->next += n;
+  return p;
+}
+
+// Free everything allocated from a.
+void
+arena_reset(struct arena *a)
+{
+  a->cur = 0;
+  a->next = a->end = 0;
+}
+
+// Free a and its memory.
+void
+arena_free(struct arena *a)
+{
+  struct chunk *c, *next;
+
+  for(c = a->chunks; c; c = next){
+    next = c->next;
+    free(c);
+  }
+  free(a);
+}
@@ -0,0 +1,65 @@
+// Compare the cost of parsing sh commands with sh's parser
+// allocating from malloc() and free() and from an arena.
+//
+// usage: arenabench [commands]
+//
+// parse each of a few typical command lines in turn, with
+// parsecmd() from shparse.c, as sh does; freeing each parsed
+// command with freecmd(), or by resetting the arena at the
+// next parsecmd().
+
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/sh.h"
+
+char *lines[] = {
+  "ls\n",
+  "cat < in | grep x > out\n",
+  "echo a b c; echo d > f &\n",
+  "(cat f; ls) | wc\n",
+};
+#define NLINES (sizeof(lines) / sizeof(lines[0]))
+
+void
+panic(char *s)
+{
+  fprintf(2, "arenabench: %s\n", s);
+  exit(1);
+}
+
+// parse n lines; returns the ticks it took.
+int
+run(int n)
+{
+  char buf[100];
+  struct cmd *cmd;
+  int i, t0;
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    // parsecmd() writes NULs into the line.
+    strcpy(buf, lines[i % NLINES]);
+    cmd = parsecmd(buf);
+    freecmd(cmd);
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 200000, tmalloc, tarena;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+
+  cmds = 0;
+  tmalloc = run(n);
+  if((cmds = arena_new(0)) == 0)
+    panic("arena_new failed");
+  tarena = run(n);
+  arena_free(cmds);
+
+  printf("%d commands: malloc/free %d ticks, arena %d ticks\n", n, tmalloc, tarena);
+  exit(0);
+}
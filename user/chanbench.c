@@ -0,0 +1,163 @@
+// Compare passing values from producer to consumer uthreads
+// through a uchan with doing it through a ring buffer that
+// each side polls, yielding while it is full or empty, with
+// 1 and 4 of each, run by 1, 2 and 4 worker kthreads.
+//
+// usage: chanbench [values]
+//
+// each run happens in a child, since the last uthread to
+// exit ends the process; the producers share the values out
+// evenly and the last consumer to finish reports the time.
+
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/uthread.h"
+
+#define RING 16
+
+int nvalues = 100000;
+int npairs, nworkers, each, done, t0;
+char *how;
+struct uchan *chan;
+
+struct {
+  int lock;
+  uint64 buf[RING];
+  int head, n;
+} ring;
+
+void
+finish(void)
+{
+  if(__sync_add_and_fetch(&done, 1) == npairs)
+    printf("%s, %d pairs, %d workers: %d values in %d ticks\n", how,
+           npairs, nworkers, each * npairs, uptime() - t0);
+  uthread_exit();
+}
+
+void
+chanproducer(void)
+{
+  uint64 i;
+
+  for(i = 0; i < each; i++)
+    uchan_send(chan, (void*)i);
+  uthread_exit();
+}
+
+void
+chanconsumer(void)
+{
+  void *v;
+  int i;
+
+  for(i = 0; i < each; i++)
+    uchan_recv(chan, &v);
+  finish();
+}
+
+// put v in the ring, or return -1 if it is full.
+int
+ringput(uint64 v)
+{
+  int r = -1;
+
+  preempt_off();
+  while(__sync_lock_test_and_set(&ring.lock, 1) != 0)
+    ;
+  if(ring.n < RING){
+    ring.buf[(ring.head + ring.n++) % RING] = v;
+    r = 0;
+  }
+  __sync_lock_release(&ring.lock);
+  preempt_on();
+  return r;
+}
+
+// take a value from the ring, or return -1 if it is empty.
+int
+ringget(uint64 *v)
+{
+  int r = -1;
+
+  preempt_off();
+  while(__sync_lock_test_and_set(&ring.lock, 1) != 0)
+    ;
+  if(ring.n > 0){
+    *v = ring.buf[ring.head];
+    ring.head = (ring.head + 1) % RING;
+    ring.n--;
+    r = 0;
+  }
+  __sync_lock_release(&ring.lock);
+  preempt_on();
+  return r;
+}
+
+void
+spinproducer(void)
+{
+  uint64 i;
+
+  for(i = 0; i < each; i++)
+    while(ringput(i) < 0)
+      uthread_yield();
+  uthread_exit();
+}
+
+void
+spinconsumer(void)
+{
+  uint64 v;
+  int i;
+
+  for(i = 0; i < each; i++)
+    while(ringget(&v) < 0)
+      uthread_yield();
+  finish();
+}
+
+int
+run(int spin, int pairs, int workers)
+{
+  int i, xstatus;
+
+  if(fork() == 0){
+    how = spin ? "yield-spin" : "uchan";
+    npairs = pairs;
+    nworkers = workers;
+    each = nvalues / pairs;
+    uthread_set_workers(workers);
+    if((chan = uchan_new(RING)) == 0){
+      fprintf(2, "chanbench: uchan_new failed\n");
+      exit(1);
+    }
+    for(i = 0; i < pairs; i++){
+      if(uthread_create(spin ? spinproducer : chanproducer, MEDIUM) < 0 ||
+         uthread_create(spin ? spinconsumer : chanconsumer, MEDIUM) < 0){
+        fprintf(2, "chanbench: uthread_create failed\n");
+        exit(1);
+      }
+    }
+    t0 = uptime();
+    uthread_start_all();
+    exit(1);
+  }
+  wait(&xstatus);
+  return xstatus;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int spin, n, w;
+
+  if(argc > 1)
+    nvalues = atoi(argv[1]);
+  for(w = 1; w <= 4; w *= 2)
+    for(n = 1; n <= 4; n *= 4)
+      for(spin = 0; spin < 2; spin++)
+        if(run(spin, n, w) != 0)
+          exit(1);
+  exit(0);
+}
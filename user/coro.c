@@ -0,0 +1,119 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "uthread.h"
+
+// Coroutines: functions that run on a stack of their own, a
+// step at a time, for pipelines of small stages like a
+// tokenizer feeding a parser.
+//
+// coro_resume() switches straight to a coroutine with
+// uswtch(), saving its caller's registers in the coroutine,
+// and coro_yield_value() switches back to that caller, each
+// passing a value to the other. There is no scheduler and no
+// locking: a coroutine runs as part of whatever resumed it,
+// a uthread or a plain kthread, and may resume coroutines of
+// its own. A coroutine stack can be much smaller than a
+// uthread's, but a uthread that may be preempted while one
+// runs needs room on it for the upcall's saved registers and
+// preempt()'s switch to the next thread, and back through
+// finish(): about 700 bytes beyond the coroutine's own use,
+// which CORO_STACK leaves plenty of room for.
+//
+// A word of a known value at the bottom of each stack is
+// checked whenever the coroutine switches away, to catch an
+// overflow before it does more damage.
+
+#define CANARY 0x636f726f636f726fL
+
+extern void corostart(void);
+
+static void checkcanary(struct coro *c)
+{
+    if (*c->canary != CANARY)
+    {
+        fprintf(2, "coro: stack overflow\n");
+        exit(1);
+    }
+}
+
+// The bottom of c's stack: run its function, then go back to
+// the caller for good.
+static void coromain(struct coro *c)
+{
+    c->val = c->fn(c, c->val);
+    c->done = 1;
+    c->running = 0;
+    checkcanary(c);
+    uswtch(&c->context, &c->back);
+    fprintf(2, "coro: finished coroutine ran\n");
+    exit(1);
+}
+
+// Make a coroutine that runs fn on a stack of stacksize bytes,
+// or CORO_STACK if 0. fn starts at the first coro_resume(),
+// with the value passed to it, and what fn returns is that
+// resume's result. Returns 0 if out of memory.
+struct coro *coro_create(void *(*fn)(struct coro *self, void *val), uint stacksize)
+{
+    struct coro *c;
+    uint64 stack;
+
+    if (stacksize == 0)
+        stacksize = CORO_STACK;
+    stacksize = (stacksize + 15) & ~15;
+    if ((c = malloc(sizeof(*c) + stacksize + 16)) == 0)
+        return 0;
+    memset(c, 0, sizeof(*c));
+    c->fn = fn;
+    stack = ((uint64)(c + 1) + 15) & ~15L;
+    c->canary = (uint64 *)stack;
+    *c->canary = CANARY;
+    c->context.ra = (uint64)corostart;
+    c->context.sp = stack + stacksize;
+    c->context.s0 = (uint64)c;
+    c->context.s1 = (uint64)coromain;
+    return c;
+}
+
+// Run c until it yields or returns, passing it val. Returns
+// the value it yields or returns, or 0 if it already had.
+void *coro_resume(struct coro *c, void *val)
+{
+    if (c->done)
+        return 0;
+    if (c->running)
+    {
+        fprintf(2, "coro_resume: coroutine is running\n");
+        exit(1);
+    }
+    c->running = 1;
+    c->val = val;
+    uswtch(&c->back, &c->context);
+    return c->val;
+}
+
+// Suspend self, the running coroutine, making val the result
+// of the coro_resume() that ran it. Returns the value passed
+// to the next one.
+void *coro_yield_value(struct coro *self, void *val)
+{
+    checkcanary(self);
+    self->running = 0;
+    self->val = val;
+    uswtch(&self->context, &self->back);
+    return self->val;
+}
+
+// Has c's function returned?
+int coro_done(struct coro *c)
+{
+    return c->done;
+}
+
+// Free c, which mustn't be running; if it is suspended, it
+// never finishes.
+void coro_free(struct coro *c)
+{
+    free(c);
+}
@@ -0,0 +1,107 @@
+// Compare the cost of a switch between coroutines with
+// coro_resume() and coro_yield_value() with one between two
+// uthreads with uthread_yield(), and run a two-stage pipeline
+// of coroutines on stacks of a few sizes.
+//
+// usage: corobench [switches]
+//
+// the uthreads run in a child, since the last one to exit
+// ends the process, on one worker so that each yield switches
+// to the other thread.
+
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/uthread.h"
+
+int nswitches = 1000000;
+int done, t0;
+
+// yield 0, 1, 2, ... forever.
+void*
+counter(struct coro *self, void *val)
+{
+  uint64 i;
+
+  for(i = 0; ; i++)
+    coro_yield_value(self, (void*)i);
+  return 0;
+}
+
+// yield the even values that counter(), passed in as val,
+// yields.
+void*
+evens(struct coro *self, void *val)
+{
+  struct coro *src = val;
+  uint64 v;
+
+  for(;;){
+    v = (uint64)coro_resume(src, 0);
+    if(v % 2 == 0)
+      coro_yield_value(self, (void*)v);
+  }
+  return 0;
+}
+
+void
+pingpong(void)
+{
+  int i;
+
+  for(i = 0; i < nswitches / 2; i++)
+    uthread_yield();
+  if(__sync_add_and_fetch(&done, 1) == 2)
+    printf("uthread_yield: %d switches in %d ticks\n", nswitches, uptime() - t0);
+  uthread_exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct coro *c, *src;
+  int i, t1, xstatus;
+  uint size;
+
+  if(argc > 1)
+    nswitches = atoi(argv[1]);
+
+  if((c = coro_create(counter, 0)) == 0){
+    fprintf(2, "corobench: coro_create failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; i < nswitches / 2; i++)
+    coro_resume(c, 0);
+  t1 = uptime();
+  coro_free(c);
+  printf("coro_resume/coro_yield_value: %d switches in %d ticks\n", nswitches, t1 - t0);
+
+  for(size = 256; size <= 4096; size *= 4){
+    if((src = coro_create(counter, size)) == 0 || (c = coro_create(evens, size)) == 0){
+      fprintf(2, "corobench: coro_create failed\n");
+      exit(1);
+    }
+    coro_resume(c, src);
+    t0 = uptime();
+    for(i = 0; i < nswitches / 6; i++)
+      coro_resume(c, 0);
+    t1 = uptime();
+    coro_free(c);
+    coro_free(src);
+    printf("pipeline, %d-byte stacks: %d switches in %d ticks\n", size,
+           nswitches / 6 * 6, t1 - t0);
+  }
+
+  if(fork() == 0){
+    uthread_set_workers(1);
+    if(uthread_create(pingpong, MEDIUM) < 0 || uthread_create(pingpong, MEDIUM) < 0){
+      fprintf(2, "corobench: uthread_create failed\n");
+      exit(1);
+    }
+    t0 = uptime();
+    uthread_start_all();
+    exit(1);
+  }
+  wait(&xstatus);
+  exit(xstatus);
+}
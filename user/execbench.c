@@ -0,0 +1,69 @@
+// Compare exec() latency with eager and demand-paged
+// loading of program segments.
+//
+// usage: execbench [iterations [program]]
+//
+// each iteration forks a child that execs program with a
+// bad argument, so it exits right after startup; its output
+// is discarded by closing fds 1 and 2 first.
+
+#include "kernel/types.h"
+#include "kernel/vmstat.h"
+#include "user/user.h"
+
+int
+run(char *prog, int n, int lazy)
+{
+  char *argv[] = { prog, "-?", 0 };
+  struct vmstat st0, st1;
+  int i, pid, t0, t1;
+
+  vmtune(VM_LAZYEXEC, lazy);
+  vmstat(&st0);
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "execbench: fork failed\n");
+      return -1;
+    }
+    if(pid == 0){
+      close(1);
+      close(2);
+      exec(prog, argv);
+      exit(1);
+    }
+    wait(0);
+  }
+  t1 = uptime();
+  vmstat(&st1);
+
+  printf("%s: %d execs of %s in %d ticks", lazy ? "lazy " : "eager", n, prog, t1 - t0);
+  if(lazy)
+    printf(", %d of %d segment pages loaded",
+           (int)(st1.exec_loads - st0.exec_loads),
+           (int)(st1.exec_pages - st0.exec_pages));
+  printf("\n");
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 100;
+  char *prog = "usertests";
+  int old;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(argc > 2)
+    prog = argv[2];
+
+  old = vmtune(VM_LAZYEXEC, -1);
+  if(run(prog, n, 0) < 0 || run(prog, n, 1) < 0){
+    vmtune(VM_LAZYEXEC, old);
+    exit(1);
+  }
+  vmtune(VM_LAZYEXEC, old);
+  exit(0);
+}
@@ -0,0 +1,98 @@
+// Print page fault counters: for the whole system, with
+// latency histograms, for each process, and the log of
+// recent faults if there is one.
+//
+// usage: faults [log on|off]
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/meminfo.h"
+#include "kernel/fault.h"
+#include "kernel/vmstat.h"
+#include "user/user.h"
+
+char *kinds[NFAULT] = {
+  [FAULT_MINOR] "minor",
+  [FAULT_ZERO]  "zero",
+  [FAULT_COW]   "cow",
+  [FAULT_FILE]  "file",
+  [FAULT_SWAP]  "swap",
+  [FAULT_BAD]   "bad",
+};
+
+struct faultstat fs;
+struct meminfo mi;
+
+// print the latency histogram of one kind of fault, with
+// bucket bounds in microseconds, for qemu's 10 MHz timer.
+void
+hist(int k)
+{
+  int i;
+
+  printf("%s:", kinds[k]);
+  for(i = 0; i < NFAULTHIST; i++){
+    if(fs.hist[k][i] == 0)
+      continue;
+    if(i < NFAULTHIST - 1)
+      printf(" <%d.%dus:%d", (2 << i) / 10, (2 << i) % 10, (int)fs.hist[k][i]);
+    else
+      printf(" more:%d", (int)fs.hist[k][i]);
+  }
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct faultrec *f;
+  uint64 n;
+  int i, k;
+
+  if(argc == 3 && strcmp(argv[1], "log") == 0){
+    vmtune(VM_FAULTLOG, strcmp(argv[2], "on") == 0);
+    exit(0);
+  }
+  if(argc != 1){
+    fprintf(2, "usage: faults [log on|off]\n");
+    exit(1);
+  }
+
+  if(faultstat(0, &fs) < 0){
+    fprintf(2, "faults: failed\n");
+    exit(1);
+  }
+  for(k = 0; k < NFAULT; k++)
+    printf("%s\t%d\n", kinds[k], (int)fs.count[k]);
+  printf("\nlatency\n");
+  for(k = 0; k < NFAULT; k++)
+    if(fs.count[k])
+      hist(k);
+
+  if(fs.nlog > 0){
+    printf("\nrecent\npid\tkind\tva\t\tepc\t\tus\n");
+    n = fs.nlog < NFAULTLOG ? fs.nlog : NFAULTLOG;
+    for(i = 0; i < n; i++){
+      f = &fs.log[(fs.nlog - n + i) % NFAULTLOG];
+      printf("%d\t%s\t%p\t%p\t%d\n", f->pid, kinds[f->kind], f->va, f->epc,
+             (int)(f->time / 10));
+    }
+  }
+
+  // the processes, found through meminfo().
+  if(meminfo(&mi) < 0)
+    exit(0);
+  printf("\npid");
+  for(k = 0; k < NFAULT; k++)
+    printf("\t%s", kinds[k]);
+  printf("\tname\n");
+  for(i = 0; i < mi.nproc; i++){
+    if(faultstat(mi.proc[i].pid, &fs) < 0)
+      continue;
+    printf("%d", mi.proc[i].pid);
+    for(k = 0; k < NFAULT; k++)
+      printf("\t%d", (int)fs.count[k]);
+    printf("\t%s\n", mi.proc[i].name);
+  }
+  exit(0);
+}
@@ -0,0 +1,143 @@
+// Measure malloc() and free() throughput with 1, 2 and 4
+// kthreads allocating at once, and as the heap fragments.
+//
+// usage: mallocbench [operations]
+//
+// each thread keeps a window of live blocks of random small
+// sizes, replacing a random one with a new block per
+// operation, and checks that no block it gets back was
+// written by anyone else while it held it.
+//
+// then, with more and more free holes left in the heap, too
+// small for the requests that follow, time large malloc/free
+// pairs; the time per pair shouldn't grow with the holes.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define MAXTHREADS 4
+#define LIVE 64           // blocks each thread holds at once
+#define STACKSIZE 8192
+#define MAXHOLES 4000
+
+int nops = 100000;
+int nextid;
+volatile int bad;
+
+uint
+rnd(uint *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+void
+worker(void)
+{
+  char *live[LIVE];
+  uint size[LIVE];
+  uint seed;
+  int i, j, id;
+
+  id = __sync_fetch_and_add(&nextid, 1);
+  seed = id + 1;
+  memset(live, 0, sizeof(live));
+  for(i = 0; i < nops; i++){
+    j = rnd(&seed) % LIVE;
+    if(live[j]){
+      if(live[j][0] != (char)id || live[j][size[j]-1] != (char)id)
+        bad = 1;
+      free(live[j]);
+    }
+    size[j] = 1 + rnd(&seed) % 512;
+    if((live[j] = malloc(size[j])) == 0){
+      bad = 1;
+      break;
+    }
+    live[j][0] = live[j][size[j]-1] = id;
+  }
+  for(j = 0; j < LIVE; j++)
+    free(live[j]);
+  kthread_exit(0);
+}
+
+int
+run(int n)
+{
+  char *stack[MAXTHREADS];
+  int tid[MAXTHREADS];
+  int i, t0, t1;
+
+  nextid = 0;
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    stack[i] = malloc(STACKSIZE);
+    if((tid[i] = kthread_create((void *(*)())worker, stack[i], STACKSIZE)) <= 0){
+      fprintf(2, "mallocbench: kthread_create failed\n");
+      return -1;
+    }
+  }
+  for(i = 0; i < n; i++)
+    kthread_join(tid[i], 0);
+  t1 = uptime();
+  for(i = 0; i < n; i++)
+    free(stack[i]);
+
+  printf("%d threads: %d malloc/free pairs each in %d ticks\n", n, nops, t1 - t0);
+  return 0;
+}
+
+int
+fragment(int holes)
+{
+  static char *keep[2*MAXHOLES];
+  uint seed = 1;
+  char *p;
+  int i, t0, t1;
+
+  for(i = 0; i < 2*holes; i++){
+    if((keep[i] = malloc(2100 + rnd(&seed) % 2000)) == 0){
+      fprintf(2, "mallocbench: out of memory\n");
+      return -1;
+    }
+  }
+  // free every other block, leaving holes between those kept.
+  for(i = 0; i < 2*holes; i += 2)
+    free(keep[i]);
+
+  t0 = uptime();
+  for(i = 0; i < nops; i++){
+    if((p = malloc(4200 + rnd(&seed) % 2000)) == 0){
+      fprintf(2, "mallocbench: out of memory\n");
+      return -1;
+    }
+    free(p);
+  }
+  t1 = uptime();
+  printf("%d holes: %d large malloc/free pairs in %d ticks\n", holes, nops, t1 - t0);
+
+  for(i = 1; i < 2*holes; i += 2)
+    free(keep[i]);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n;
+
+  if(argc > 1)
+    nops = atoi(argv[1]);
+  for(n = 1; n <= MAXTHREADS; n *= 2)
+    if(run(n) < 0)
+      exit(1);
+  for(n = 0; n <= MAXHOLES; n = n ? 2*n : MAXHOLES/8)
+    if(fragment(n) < 0)
+      exit(1);
+  printf("%d KB of heap given back to the kernel\n", (int)(mallocreleased() / 1024));
+  if(bad){
+    fprintf(2, "mallocbench: a block was handed out twice\n");
+    exit(1);
+  }
+  exit(0);
+}
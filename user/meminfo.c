@@ -0,0 +1,42 @@
+// Print physical memory usage, system-wide and for each
+// process.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/meminfo.h"
+#include "user/user.h"
+
+struct meminfo mi;
+
+void
+pages(char *what, uint64 n)
+{
+  printf("%s %d pages (%d KB)\n", what, (int)n, (int)(n * PGSIZE / 1024));
+}
+
+int
+main(void)
+{
+  struct procmem *m;
+
+  if(meminfo(&mi) < 0){
+    fprintf(2, "meminfo: failed\n");
+    exit(1);
+  }
+  pages("memory     ", mi.total);
+  pages("free       ", mi.free);
+  pages("used       ", mi.total - mi.free);
+  pages("kernel     ", mi.kernel);
+  pages("page tables", mi.pagetables);
+  pages("trapframes ", mi.trapframes);
+  pages("kstacks    ", mi.kstacks);
+  pages("pipes      ", mi.pipes);
+  pages("zram pool  ", mi.zram);
+
+  printf("\npid\trss\tswapped\tptpages\tname\n");
+  for(m = mi.proc; m < &mi.proc[mi.nproc]; m++)
+    printf("%d\t%d\t%d\t%d\t%s\n", m->pid, (int)m->rss, (int)m->swapped,
+           (int)m->ptpages, m->name);
+  exit(0);
+}
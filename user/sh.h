@@ -0,0 +1,62 @@
+// Parsed commands, for sh and arenabench: shparse.c.
+
+// Parsed command representation
+#define EXEC 1
+#define REDIR 2
+#define PIPE 3
+#define LIST 4
+#define BACK 5
+
+#define MAXARGS 10
+
+struct cmd
+{
+    int type;
+};
+
+struct execcmd
+{
+    int type;
+    char *argv[MAXARGS];
+    char *eargv[MAXARGS];
+};
+
+struct redircmd
+{
+    int type;
+    struct cmd *cmd;
+    char *file;
+    char *efile;
+    int mode;
+    int fd;
+};
+
+struct pipecmd
+{
+    int type;
+    struct cmd *left;
+    struct cmd *right;
+};
+
+struct listcmd
+{
+    int type;
+    struct cmd *left;
+    struct cmd *right;
+};
+
+struct backcmd
+{
+    int type;
+    struct cmd *cmd;
+};
+
+// if set, parsecmd() allocates from here, resetting it
+// first; otherwise from malloc(), for freecmd() to free.
+extern struct arena *cmds;
+
+struct cmd *parsecmd(char *);
+void freecmd(struct cmd *);
+
+// the program's, called on a syntax error.
+void panic(char *);
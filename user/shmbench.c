@@ -0,0 +1,171 @@
+// Compare pipe and shared memory throughput between a
+// producer and a consumer process.
+//
+// usage: shmbench [megabytes]
+//
+// the producer fills each 4096-byte chunk with a pattern
+// and the consumer sums it. through a pipe, every chunk is
+// copied into the kernel and out again; through shared
+// memory, both sides work on a ring of chunks in place,
+// passing ownership with head and tail counters.
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define CHUNK PGSIZE
+#define NSLOT 16
+
+struct ring {
+  volatile uint head;   // chunks produced
+  volatile uint tail;   // chunks consumed
+  char pad[PGSIZE - 2*sizeof(uint)];
+  char slot[NSLOT][CHUNK];
+};
+
+char buf[CHUNK];
+uint want;   // the checksum the consumer should arrive at
+
+void
+fill(char *p, int n)
+{
+  int i;
+
+  for(i = 0; i < CHUNK; i++)
+    p[i] = n + i;
+}
+
+uint
+sum(char *p)
+{
+  uint s = 0;
+  int i;
+
+  for(i = 0; i < CHUNK; i++)
+    s += (uchar)p[i];
+  return s;
+}
+
+uint
+expect(int n)
+{
+  uint s = 0;
+  int i;
+
+  for(i = 0; i < n; i++){
+    fill(buf, i);
+    s += sum(buf);
+  }
+  return s;
+}
+
+int
+bypipe(int n)
+{
+  int fds[2], i, m, t0, t1, pid, xstatus;
+  uint s;
+
+  if(pipe(fds) < 0){
+    fprintf(2, "shmbench: pipe failed\n");
+    return -1;
+  }
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "shmbench: fork failed\n");
+    return -1;
+  }
+  if(pid == 0){
+    close(fds[1]);
+    s = 0;
+    for(i = 0; i < n; i++){
+      for(m = 0; m < CHUNK; m += read(fds[0], buf + m, CHUNK - m))
+        ;
+      s += sum(buf);
+    }
+    exit(s == want ? 0 : 1);
+  }
+  close(fds[0]);
+  for(i = 0; i < n; i++){
+    fill(buf, i);
+    if(write(fds[1], buf, CHUNK) != CHUNK){
+      fprintf(2, "shmbench: write failed\n");
+      break;
+    }
+  }
+  close(fds[1]);
+  wait(&xstatus);
+  t1 = uptime();
+  if(xstatus != 0){
+    fprintf(2, "shmbench: pipe data corrupted\n");
+    return -1;
+  }
+  printf("pipe: %d KB in %d ticks\n", n * (CHUNK / 1024), t1 - t0);
+  return 0;
+}
+
+int
+byshm(int n)
+{
+  struct ring *r;
+  int i, id, t0, t1, pid, xstatus;
+  uint s;
+
+  if((id = shmget(getpid() + 1, sizeof(struct ring))) < 0 ||
+     (r = shmat(id)) == (struct ring *)-1){
+    fprintf(2, "shmbench: shmget failed\n");
+    return -1;
+  }
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "shmbench: fork failed\n");
+    return -1;
+  }
+  if(pid == 0){
+    s = 0;
+    for(i = 0; i < n; i++){
+      while(r->tail == r->head)
+        ;
+      __sync_synchronize();
+      s += sum(r->slot[i % NSLOT]);
+      __sync_synchronize();
+      r->tail = i + 1;
+    }
+    exit(s == want ? 0 : 1);
+  }
+  for(i = 0; i < n; i++){
+    while(r->head - r->tail == NSLOT)
+      ;
+    __sync_synchronize();
+    fill(r->slot[i % NSLOT], i);
+    __sync_synchronize();
+    r->head = i + 1;
+  }
+  wait(&xstatus);
+  t1 = uptime();
+  shmdt(r);
+  if(xstatus != 0){
+    fprintf(2, "shmbench: shm data corrupted\n");
+    return -1;
+  }
+  printf("shm:  %d KB in %d ticks\n", n * (CHUNK / 1024), t1 - t0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = 4;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb <= 0){
+    fprintf(2, "usage: shmbench [megabytes]\n");
+    exit(1);
+  }
+  want = expect(mb * 256);
+  if(bypipe(mb * 256) < 0 || byshm(mb * 256) < 0)
+    exit(1);
+  exit(0);
+}
@@ -0,0 +1,88 @@
+// Compare swapping to the disk with keeping swapped-out
+// pages compressed in RAM.
+//
+// usage: swapbench [megabytes [passes]]
+//
+// a child grows its heap by megabytes, more than fits in
+// memory, fills every page with a compressible pattern, and
+// times passes that read one word of every page back, which
+// must swap pages in and others out.
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/vmstat.h"
+#include "user/user.h"
+
+int
+run(int mb, int passes, int zram)
+{
+  struct vmstat st0, st1;
+  uint64 i, j, n = (uint64)mb * 1024 * 1024;
+  int pass, pid, xstatus, t0, t1, loads;
+  uint64 *w;
+  char *a;
+
+  vmtune(VM_ZRAM, zram);
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "swapbench: fork failed\n");
+    return -1;
+  }
+  if(pid == 0){
+    if((a = sbrk(n)) == (char*)-1){
+      fprintf(2, "swapbench: sbrk failed\n");
+      exit(1);
+    }
+    vmstat(&st0);
+    t0 = uptime();
+    for(i = 0; i < n; i += PGSIZE){
+      w = (uint64*)(a + i);
+      for(j = 0; j < PGSIZE/8; j++)
+        w[j] = i / PGSIZE + j % 16;
+    }
+    for(pass = 0; pass < passes; pass++){
+      for(i = 0; i < n; i += PGSIZE){
+        if(*(uint64*)(a + i) != i / PGSIZE){
+          fprintf(2, "swapbench: page %d came back wrong\n", (int)(i / PGSIZE));
+          exit(1);
+        }
+      }
+    }
+    t1 = uptime();
+    vmstat(&st1);
+
+    loads = st1.zram_loads - st0.zram_loads;
+    printf("%s: %d MB, %d passes in %d ticks, %d swap-outs, %d swap-ins (%d from RAM)\n",
+           zram ? "compressed in RAM" : "disk only", mb, passes, t1 - t0,
+           (int)(st1.swap_outs - st0.swap_outs),
+           (int)(st1.swap_ins - st0.swap_ins), loads);
+    if(st1.zram_pages)
+      printf("  %d pages compressed to %d%% in %d pool pages\n",
+             (int)st1.zram_pages,
+             (int)(st1.zram_bytes * 100 / (st1.zram_pages * PGSIZE)),
+             (int)st1.zram_pool);
+    exit(0);
+  }
+  wait(&xstatus);
+  return xstatus == 0 ? 0 : -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = (PHYSTOP - KERNBASE) / (1024 * 1024) + 16, passes = 2;
+  int old, r;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(argc > 2)
+    passes = atoi(argv[2]);
+
+  old = vmtune(VM_ZRAM, -1);
+  r = run(mb, passes, 0);
+  if(r == 0)
+    r = run(mb, passes, 1);
+  vmtune(VM_ZRAM, old);
+  exit(r == 0 ? 0 : 1);
+}
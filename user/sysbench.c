@@ -0,0 +1,81 @@
+// Time system calls and context switches.
+//
+// usage: sysbench [rounds]
+//
+// the first test makes rounds getpid() calls, each a round
+// trip into the kernel and back. the second passes a byte
+// back and forth rounds times between two processes through
+// a pair of pipes, switching address spaces each time.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+int
+syscalls(int n)
+{
+  int i, t0, t1;
+
+  t0 = uptime();
+  for(i = 0; i < n; i++)
+    getpid();
+  t1 = uptime();
+  printf("getpid: %d calls in %d ticks\n", n, t1 - t0);
+  return 0;
+}
+
+int
+pingpong(int n)
+{
+  int ping[2], pong[2], i, t0, t1, pid, xstatus;
+  char c = 0;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    fprintf(2, "sysbench: pipe failed\n");
+    return -1;
+  }
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "sysbench: fork failed\n");
+    return -1;
+  }
+  if(pid == 0){
+    for(i = 0; i < n; i++){
+      if(read(ping[0], &c, 1) != 1 || write(pong[1], &c, 1) != 1)
+        exit(1);
+    }
+    exit(0);
+  }
+  for(i = 0; i < n; i++){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      fprintf(2, "sysbench: pipe broke\n");
+      break;
+    }
+  }
+  wait(&xstatus);
+  t1 = uptime();
+  close(ping[0]);
+  close(ping[1]);
+  close(pong[0]);
+  close(pong[1]);
+  if(xstatus != 0)
+    return -1;
+  printf("pingpong: %d round trips in %d ticks\n", n, t1 - t0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 100000;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    fprintf(2, "usage: sysbench [rounds]\n");
+    exit(1);
+  }
+  if(syscalls(n) < 0 || pingpong(n / 10) < 0)
+    exit(1);
+  exit(0);
+}
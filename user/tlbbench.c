@@ -0,0 +1,72 @@
+// Compare heap access time with and without 2 MB superpages.
+//
+// usage: tlbbench [megabytes [passes]]
+//
+// a child grows its heap by megabytes, touches every page
+// once to fault it in, then times passes over the heap that
+// read one word per 4 KB page, which needs a TLB entry per
+// access when the heap is mapped with 4 KB pages.
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/vmstat.h"
+#include "user/user.h"
+
+int
+run(int mb, int passes, int super)
+{
+  struct vmstat st0, st1;
+  uint64 i, n = (uint64)mb * 1024 * 1024;
+  int pass, pid, xstatus, t0, t1;
+  volatile char *a;
+  uint sum = 0;
+
+  vmtune(VM_SUPERPAGES, super);
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "tlbbench: fork failed\n");
+    return -1;
+  }
+  if(pid == 0){
+    vmstat(&st0);
+    if((a = sbrk(n)) == (char*)-1){
+      fprintf(2, "tlbbench: sbrk failed\n");
+      exit(1);
+    }
+    for(i = 0; i < n; i += PGSIZE)
+      a[i] = 1;
+    vmstat(&st1);
+
+    t0 = uptime();
+    for(pass = 0; pass < passes; pass++)
+      for(i = (pass * 64) % PGSIZE; i < n; i += PGSIZE)
+        sum += a[i];
+    t1 = uptime();
+
+    printf("%s: %d passes over %d MB in %d ticks, %d superpages (sum %d)\n",
+           super ? "2 MB pages" : "4 KB pages", passes, mb, t1 - t0,
+           (int)(st1.super_allocs - st0.super_allocs), sum);
+    exit(0);
+  }
+  wait(&xstatus);
+  return xstatus == 0 ? 0 : -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = 16, passes = 200;
+  int old, r;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(argc > 2)
+    passes = atoi(argv[2]);
+
+  old = vmtune(VM_SUPERPAGES, -1);
+  r = run(mb, passes, 0);
+  if(r == 0)
+    r = run(mb, passes, 1);
+  vmtune(VM_SUPERPAGES, old);
+  exit(r == 0 ? 0 : 1);
+}
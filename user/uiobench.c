@@ -0,0 +1,116 @@
+// Measure throughput of uthreads that alternate computing
+// with waiting, with 1, 4, 16 and 64 uthreads on one worker.
+//
+// usage: uiobench [requests]
+//
+// each request computes for a while and then waits, first a
+// tick in uthread_sleep(), as if for a slow device, then for
+// a round trip through pipes to a child process that answers
+// the requests it has once a tick; the threads share the
+// requests out evenly. while one thread waits the others
+// run, so the time should fall as threads are added until
+// the computing fills the ticks. each run happens in a
+// child, since the last uthread to exit ends the process.
+
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/uthread.h"
+
+#define WORK 20000      // loop iterations of computing per request
+
+int nreqs = 256;
+int nthreads, each, done, t0;
+int usepipe, reqfd, replyfd;
+char *how;
+volatile int sink;
+
+void
+worker(void)
+{
+  int i, j;
+  char c = 'x';
+
+  for(i = 0; i < each; i++){
+    for(j = 0; j < WORK; j++)
+      sink += j;
+    if(!usepipe)
+      uthread_sleep(1);
+    else if(uthread_write(reqfd, &c, 1) != 1 || uthread_read(replyfd, &c, 1) != 1){
+      fprintf(2, "uiobench: pipe failed\n");
+      exit(1);
+    }
+  }
+  if(++done == nthreads)
+    printf("%d uthreads, %s: %d requests in %d ticks\n", nthreads, how,
+           each * nthreads, uptime() - t0);
+  uthread_exit();
+}
+
+// answer the requests on fd req, those there are once a
+// tick, until the other end closes.
+void
+device(int req, int reply)
+{
+  char buf[64];
+  int n;
+
+  while((n = read(req, buf, sizeof(buf))) > 0){
+    sleep(1);
+    if(write(reply, buf, n) != n)
+      break;
+  }
+  exit(0);
+}
+
+int
+run(int n, int pipes)
+{
+  int i, xstatus, req[2], reply[2];
+
+  if(fork() == 0){
+    nthreads = n;
+    each = nreqs / n;
+    usepipe = pipes;
+    how = pipes ? "pipe" : "sleep";
+    if(pipes){
+      if(pipe(req) < 0 || pipe(reply) < 0){
+        fprintf(2, "uiobench: pipe failed\n");
+        exit(1);
+      }
+      if(fork() == 0){
+        close(req[1]);
+        close(reply[0]);
+        device(req[0], reply[1]);
+      }
+      close(req[0]);
+      close(reply[1]);
+      reqfd = req[1];
+      replyfd = reply[0];
+    }
+    for(i = 0; i < n; i++){
+      if(uthread_create(worker, MEDIUM) < 0){
+        fprintf(2, "uiobench: uthread_create failed\n");
+        exit(1);
+      }
+    }
+    t0 = uptime();
+    uthread_start_all();
+    exit(1);
+  }
+  wait(&xstatus);
+  return xstatus;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, pipes;
+
+  if(argc > 1)
+    nreqs = atoi(argv[1]);
+  for(pipes = 0; pipes < 2; pipes++)
+    for(n = 1; n <= 64; n *= 4)
+      if(run(n, pipes) != 0)
+        exit(1);
+  exit(0);
+}
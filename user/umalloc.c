@@ -3,8 +3,40 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator, safe for processes with several kthreads.
+//
+// Small requests are rounded up to one of NCLASS size classes
+// and served, without locking, from the calling thread's own
+// cache of free blocks of each class. A cache that runs dry
+// takes a batch from the central free list of the class,
+// carving a new span of blocks out of the heap if that is
+// empty too; one that grows too long gives a batch back.
+//
+// Larger requests come straight from the heap, grown with
+// sbrk(). Its free blocks are kept in NBIN bins by size, four
+// to each power of two, with a bitmap of the bins that aren't
+// empty, so finding a block that fits takes a look at the
+// head of one bin and a scan of the bitmap, however many free
+// blocks there are. Each block's header says whether the one
+// before it is free, and a free block's size is repeated in
+// its last unit, so free() merges a block with its free
+// neighbours without searching either. The heap and the
+// central lists share one spinlock.
+//
+// When free() leaves a free block of at least trim bytes at
+// the end of the heap, it gives the block back to the kernel
+// with a negative sbrk(). malloctrim() sets trim.
+//
+// A kthread's cache is in its struct tls, which the tp
+// register points to. The kernel zeroes tp when a kthread
+// starts, and tls() sets it on first use, or the kthread
+// installs one newtls() made for it with settls(). Blocks
+// left in the cache of a kthread that exits stay there.
+//
+// A preemptive uthread scheduler could switch a kthread to
+// another uthread, or move a uthread to another kthread, at
+// any instruction. So malloc() and free() keep it off with
+// preempt_off() while they use a cache or hold the lock.
 
 typedef long Align;
 
@@ -18,73 +50,476 @@ union header {
 
 typedef union header Header;
 
-static Header base;
-static Header *freep;
+// a small block's header has SMALL and its class in s.size,
+// and while the block is free, the next free block in s.ptr.
+#define SMALL 0x80000000
 
-void
-free(void *ap)
+// a heap block's header has its size in units of Header in
+// s.size, with these flags. while the block is free, s.ptr
+// and the s.ptr of its second unit link it into its bin, and
+// its last unit's s.size is its size again.
+#define FREE     0x40000000   // the block is free
+#define PREVFREE 0x20000000   // the block before it is free
+#define UNITS    0x1fffffff
+#define MINUNITS 2            // room for the links and the size
+
+#define NCLASS 12
+static uint classsize[NCLASS] = {
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 1024, 2048
+};
+
+#define BATCH 32                    // blocks moved to or from a cache at once
+#define MAXCACHE (2 * BATCH)        // most blocks of a class a cache keeps
+#define SPAN (64 * 1024)            // bytes carved into blocks at once
+
+#define NBIN 128
+
+struct tcache {
+  Header *free[NCLASS];
+  int n[NCLASS];
+};
+
+static Header *bin[NBIN];
+static uint64 binmap[NBIN/64];
+static Header *top;           // the in-use unit that ends the heap
+static Header *central[NCLASS];
+static int locked;
+static int trim = 128 * 1024;
+static uint64 released;       // bytes given back to the kernel
+
+static void
+lock(void)
+{
+  while(__sync_lock_test_and_set(&locked, 1) != 0)
+    ;
+  __sync_synchronize();
+}
+
+static void
+unlock(void)
+{
+  __sync_lock_release(&locked);
+}
+
+static uint
+units(Header *h)
+{
+  return h->s.size & UNITS;
+}
+
+static int
+ilog2(uint n)
 {
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+  int r = 0;
+
+  if(n >= 1 << 16){ n >>= 16; r += 16; }
+  if(n >= 1 << 8){ n >>= 8; r += 8; }
+  if(n >= 1 << 4){ n >>= 4; r += 4; }
+  if(n >= 1 << 2){ n >>= 2; r += 2; }
+  if(n >= 1 << 1)
+    r += 1;
+  return r;
 }
 
+// The bin for free blocks of n units. Every block in a
+// higher bin is bigger than any in this one.
+static int
+binof(uint n)
+{
+  int b = ilog2(n);
+
+  if(b < 2)
+    return b * 4;
+  return b * 4 + ((n >> (b - 2)) & 3);
+}
+
+// The index of the lowest set bit in x, which isn't 0.
+static int
+lowbit(uint64 x)
+{
+  static const uchar pos[64] = {
+    0, 1, 48, 2, 57, 49, 28, 3, 61, 58, 50, 42, 38, 29, 17, 4,
+    62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+    63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+    46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9, 13, 8, 7, 6
+  };
+
+  return pos[((x & -x) * 0x03f79d71b4cb0a89UL) >> 58];
+}
+
+// The first bin from b on that isn't empty, or -1.
+static int
+nextbin(int b)
+{
+  uint64 m;
+  int w;
+
+  for(w = b / 64; w < NBIN/64; w++){
+    m = binmap[w];
+    if(w == b / 64)
+      m &= ~0UL << (b % 64);
+    if(m)
+      return w * 64 + lowbit(m);
+  }
+  return -1;
+}
+
+// Make the n units at h a free block.
+static void
+binput(Header *h, uint n)
+{
+  int b = binof(n);
+
+  h->s.size = n | FREE | (h->s.size & PREVFREE);
+  (h + n - 1)->s.size = n;
+  h->s.ptr = bin[b];
+  (h + 1)->s.ptr = 0;
+  if(bin[b])
+    (bin[b] + 1)->s.ptr = h;
+  bin[b] = h;
+  binmap[b / 64] |= 1UL << (b % 64);
+  (h + n)->s.size |= PREVFREE;
+}
+
+// Take free block h out of its bin.
+static void
+bintake(Header *h)
+{
+  int b = binof(units(h));
+  Header *next = h->s.ptr, *prev = (h + 1)->s.ptr;
+
+  if(prev)
+    prev->s.ptr = next;
+  else
+    bin[b] = next;
+  if(next)
+    (next + 1)->s.ptr = prev;
+  if(bin[b] == 0)
+    binmap[b / 64] &= ~(1UL << (b % 64));
+  h->s.size &= ~FREE;
+  (h + units(h))->s.size &= ~PREVFREE;
+}
+
+// Return heap block ap, merging it with free neighbours.
+// Returns the merged block. Caller holds the lock.
 static Header*
-morecore(uint nu)
+bigfree(void *ap)
 {
-  char *p;
-  Header *hp;
+  Header *h, *next, *prev;
+  uint n;
+
+  h = (Header*)ap - 1;
+  n = units(h);
+  next = h + n;
+  if(next->s.size & FREE){
+    bintake(next);
+    n += units(next);
+  }
+  if(h->s.size & PREVFREE){
+    prev = h - (h - 1)->s.size;
+    bintake(prev);
+    n += units(prev);
+    h = prev;
+  }
+  binput(h, n);
+  return h;
+}
 
+// Give free block h, which ends the heap, back to the kernel
+// if it is big enough. Caller holds the lock.
+static void
+shrink(Header *h)
+{
+  uint n = units(h);
+
+  if(h + n != top || n * sizeof(Header) < trim || sbrk(0) != (char*)(top + 1))
+    return;
+  bintake(h);
+  if(sbrk(-(int)(n * sizeof(Header))) == (char*)-1){
+    binput(h, n);
+    return;
+  }
+  h->s.size &= PREVFREE;
+  top = h;
+  released += n * sizeof(Header);
+}
+
+// Grow the heap by at least n units. Returns -1 if out of
+// memory.
+static int
+morecore(uint n)
+{
+  Header *h;
+  uint nu;
+
+  nu = n + 1;
   if(nu < 4096)
     nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
+  h = (Header*)sbrk(nu * sizeof(Header));
+  if(h == (Header*)-1)
+    return -1;
+  if(top && h == top + 1){
+    // right after the heap: the old end becomes the header.
+    h = top;
+  } else {
+    h->s.size = 0;
+    nu--;
+  }
+  h->s.size = nu | (h->s.size & PREVFREE);
+  top = h + nu;
+  top->s.size = 0;
+  bigfree((void*)(h + 1));
+  return 0;
+}
+
+// A free block of at least n units, or 0.
+static Header*
+fit(uint n)
+{
+  Header *h;
+  int b = binof(n);
+
+  if((h = bin[b]) != 0 && units(h) >= n)
+    return h;
+  if((b = nextbin(b + 1)) < 0)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  return bin[b];
+}
+
+// Allocate nbytes from the heap. Caller holds the lock.
+static void*
+bigalloc(uint nbytes)
+{
+  Header *h, *rest;
+  uint n, m;
+
+  n = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if(n < MINUNITS)
+    n = MINUNITS;
+  if((h = fit(n)) == 0){
+    if(morecore(n) < 0 || (h = fit(n)) == 0)
+      return 0;
+  }
+  bintake(h);
+  m = units(h);
+  if(m - n >= MINUNITS){
+    h->s.size = n | (h->s.size & PREVFREE);
+    rest = h + n;
+    rest->s.size = 0;
+    binput(rest, m - n);
+  }
+  return (void*)(h + 1);
+}
+
+// Make a struct tls, with a malloc() cache, for a kthread.
+// Returns 0 if out of memory.
+struct tls*
+newtls(void)
+{
+  struct tls *t;
+
+  lock();
+  t = bigalloc(sizeof(*t) + sizeof(struct tcache));
+  unlock();
+  if(t == 0)
+    return 0;
+  memset(t, 0, sizeof(*t) + sizeof(struct tcache));
+  t->mcache = t + 1;
+  return t;
+}
+
+// Make t the calling kthread's own data, before it has any.
+void
+settls(struct tls *t)
+{
+  asm volatile("mv tp, %0" : : "r" (t));
+}
+
+// Return the calling kthread's own data, creating it along
+// with its malloc() cache if need be, or 0 if out of memory.
+struct tls*
+tls(void)
+{
+  struct tls *t;
+
+  asm volatile("mv %0, tp" : "=r" (t));
+  if(t == 0 && (t = newtls()) != 0)
+    settls(t);
+  return t;
+}
+
+// Stop the uthread library's timer upcall from switching the
+// calling kthread to another uthread until preempt_on(), and
+// return its struct tls. The count is changed by one
+// instruction addressed by tp, so it is that of the kthread
+// the caller is on at that instant even if the caller is
+// switched around it.
+// Only a kthread with a struct tls takes the upcall: uthread
+// workers are given theirs before they start. On any other
+// kthread, this returns 0 if out of memory, with nothing to
+// keep off.
+struct tls*
+preempt_off(void)
+{
+  if(tls() == 0)
+    return 0;
+  asm volatile("amoadd.w zero, %0, (tp)" : : "r" (1) : "memory");
+  return tls();
+}
+
+// Undo a preempt_off().
+void
+preempt_on(void)
+{
+  struct tls *t;
+
+  asm volatile("mv %0, tp" : "=r" (t));
+  if(t)
+    asm volatile("amoadd.w zero, %0, (tp)" : : "r" (-1) : "memory");
+}
+
+static struct tcache*
+mycache(struct tls *t)
+{
+  return t ? t->mcache : 0;
+}
+
+// Move a batch of class k blocks into cache c from the
+// central list, or from a new span. Returns -1 if out of
+// memory.
+static int
+refill(struct tcache *c, int k)
+{
+  Header *h;
+  char *span;
+  uint bsize = sizeof(Header) + classsize[k];
+  int i;
+
+  lock();
+  for(i = 0; i < BATCH && central[k]; i++){
+    h = central[k];
+    central[k] = h->s.ptr;
+    h->s.ptr = c->free[k];
+    c->free[k] = h;
+    c->n[k]++;
+  }
+  if(i == 0){
+    if((span = bigalloc(SPAN)) == 0){
+      unlock();
+      return -1;
+    }
+    for(i = 0; i + bsize <= SPAN; i += bsize){
+      h = (Header*)(span + i);
+      h->s.size = SMALL | k;
+      h->s.ptr = c->free[k];
+      c->free[k] = h;
+      c->n[k]++;
+    }
+  }
+  unlock();
+  return 0;
+}
+
+// Move a batch of class k blocks from cache c to the
+// central list.
+static void
+drain(struct tcache *c, int k)
+{
+  Header *h;
+  int i;
+
+  lock();
+  for(i = 0; i < BATCH; i++){
+    h = c->free[k];
+    c->free[k] = h->s.ptr;
+    c->n[k]--;
+    h->s.ptr = central[k];
+    central[k] = h;
+  }
+  unlock();
+}
+
+void
+free(void *ap)
+{
+  struct tcache *c;
+  Header *h;
+  int k;
+
+  if(ap == 0)
+    return;
+  c = mycache(preempt_off());
+  h = (Header*)ap - 1;
+  if((h->s.size & SMALL) == 0){
+    lock();
+    shrink(bigfree(ap));
+    unlock();
+  } else if(c == 0){
+    k = h->s.size & ~SMALL;
+    lock();
+    h->s.ptr = central[k];
+    central[k] = h;
+    unlock();
+  } else {
+    k = h->s.size & ~SMALL;
+    h->s.ptr = c->free[k];
+    c->free[k] = h;
+    if(++c->n[k] > MAXCACHE)
+      drain(c, k);
+  }
+  preempt_on();
 }
 
 void*
 malloc(uint nbytes)
 {
-  Header *p, *prevp;
-  uint nunits;
+  struct tcache *c;
+  Header *h;
+  void *p;
+  int k;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
-  }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
+  for(k = 0; k < NCLASS && classsize[k] < nbytes; k++)
+    ;
+  c = mycache(preempt_off());
+  if(k < NCLASS && c != 0){
+    if(c->free[k] == 0 && refill(c, k) < 0){
+      preempt_on();
+      return 0;
     }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+    h = c->free[k];
+    c->free[k] = h->s.ptr;
+    c->n[k]--;
+    preempt_on();
+    return (void*)(h + 1);
   }
+  lock();
+  p = bigalloc(nbytes);
+  unlock();
+  preempt_on();
+  return p;
+}
+
+// Give free memory at the end of the heap back to the kernel
+// once there are at least threshold bytes of it. Returns the
+// old threshold; a negative threshold only queries it.
+int
+malloctrim(int threshold)
+{
+  int old;
+
+  preempt_off();
+  lock();
+  old = trim;
+  if(threshold >= 0)
+    trim = threshold;
+  unlock();
+  preempt_on();
+  return old;
+}
+
+// Bytes of heap given back to the kernel so far.
+uint64
+mallocreleased(void)
+{
+  return released;
 }
@@ -1,5 +1,17 @@
 #define KTHREAD_STACK_SIZE = 4000
 struct stat;
+struct vmstat;
+struct meminfo;
+struct faultstat;
+struct pollfd;
+struct arena;
+
+// a kthread's own data, found with tls().
+struct tls {
+  int nopreempt;  // see preempt_off(); must come first
+  void *mcache;   // malloc()'s cache of free blocks
+  void *worker;   // the uthread worker running on it
+};
 
 // system calls
 int fork(void);
@@ -28,6 +40,18 @@ int kthread_id();
 int kthread_kill(int ktid);
 void kthread_exit(int status);
 int kthread_join(int ktid, int *status);
+int vmstat(struct vmstat*);
+int vmtune(int, int);
+void* mmap(void*, uint64, int, int, int, uint64);
+int munmap(void*, uint64);
+int shmget(int, uint64);
+void* shmat(int);
+int shmdt(void*);
+int meminfo(struct meminfo*);
+int faultstat(int, struct faultstat*);
+int poll(struct pollfd*, int, int);
+int sigalarm(int, void (*)(void*));
+int sigreturn(void*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -42,6 +66,17 @@ uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
+int malloctrim(int);
+uint64 mallocreleased(void);
+struct tls* tls(void);
+struct tls* newtls(void);
+void settls(struct tls*);
+struct tls* preempt_off(void);
+void preempt_on(void);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+struct arena* arena_new(uint);
+void* arena_alloc(struct arena*, uint);
+void arena_reset(struct arena*);
+void arena_free(struct arena*);
@@ -7,6 +7,9 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/vmstat.h"
+#include "kernel/meminfo.h"
+#include "kernel/mman.h"
 #include "uthread.h"
 
 //
@@ -124,6 +127,61 @@ void copyout(char *s)
     }
 }
 
+// the kernel copies to and from user memory directly; does it
+// fault in untouched heap pages, and refuse the stack guard
+// page and the kernel's device mappings?
+void copyfault(char *s)
+{
+    char *guard = (char *)(PGROUNDDOWN((uint64)&s) - PGSIZE);
+    uint64 addrs[] = {(uint64)guard, 0x0c000000LL, 0x10000000LL};
+    int fd, fds[2], i, n;
+    char *a;
+
+    for (i = 0; i < 3; i++)
+    {
+        fd = open("README", 0);
+        if (fd < 0)
+        {
+            printf("%s: open(README) failed\n", s);
+            exit(1);
+        }
+        n = read(fd, (void *)addrs[i], 64);
+        if (n > 0)
+        {
+            printf("%s: read(fd, %p, 64) returned %d, not -1 or 0\n", s, addrs[i], n);
+            exit(1);
+        }
+        close(fd);
+        fd = open("copyfault", O_CREATE | O_WRONLY);
+        n = write(fd, (void *)addrs[i], 64);
+        close(fd);
+        unlink("copyfault");
+        if (n > 0)
+        {
+            printf("%s: write(fd, %p, 64) returned %d, not -1 or 0\n", s, addrs[i], n);
+            exit(1);
+        }
+    }
+
+    // a pipe read into lazily allocated heap.
+    a = sbrk(2 * PGSIZE);
+    if (pipe(fds) < 0)
+    {
+        printf("%s: pipe() failed\n", s);
+        exit(1);
+    }
+    memset(buf, 'p', 256);
+    if (write(fds[1], buf, 256) != 256 || read(fds[0], a + PGSIZE - 128, 256) != 256 ||
+        a[PGSIZE - 128] != 'p' || a[PGSIZE + 127] != 'p')
+    {
+        printf("%s: pipe read into new heap failed\n", s);
+        exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    sbrk(-2 * PGSIZE);
+}
+
 // what if you pass ridiculous string pointers to system calls?
 void copyinstr1(char *s)
 {
@@ -2578,17 +2636,17 @@ void sbrkfail(char *s)
     {
         // allocate a lot of memory.
         // this should produce a page fault,
-        // and thus not complete.
+        // and thus not complete. sbrk() is lazy and reads
+        // of untouched pages share the zero page, so write
+        // each page: that faults beyond the heap if sbrk()
+        // refused, and runs out of memory if it didn't.
         a = sbrk(0);
         sbrk(10 * BIG);
-        int n = 0;
         for (i = 0; i < 10 * BIG; i += PGSIZE)
         {
-            n += *(a + i);
+            *(volatile char *)(a + i) = 1;
         }
-        // print n so the compiler doesn't optimize away
-        // the for loop.
-        printf("%s: allocate a lot of memory succeeded %d\n", s, n);
+        printf("%s: allocate a lot of memory succeeded\n", s);
         exit(1);
     }
     wait(&xstatus);
@@ -2931,6 +2989,415 @@ void sbrk8000(char *s)
     *(top - 1) = *(top - 1) + 1;
 }
 
+// does sbrk() defer allocation until a page is written, and do
+// untouched pages read as zero through the shared zero page?
+void sbrklazy(char *s)
+{
+    enum
+    {
+        NPAGES = 64
+    };
+    struct vmstat st0, st1;
+    char *a;
+    int i, pid, xstatus;
+
+    vmstat(&st0);
+    a = sbrk(NPAGES * PGSIZE);
+    if (a == (char *)0xffffffffffffffffL)
+    {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < NPAGES; i++)
+    {
+        if (a[i * PGSIZE] != 0 || a[i * PGSIZE + PGSIZE - 1] != 0)
+        {
+            printf("%s: lazy page %d not zero\n", s, i);
+            exit(1);
+        }
+    }
+    vmstat(&st1);
+    if (st1.lazy_allocs != st0.lazy_allocs)
+    {
+        printf("%s: reading lazy pages allocated memory\n", s);
+        exit(1);
+    }
+    if (st1.lazy_pages - st0.lazy_pages < NPAGES)
+    {
+        printf("%s: sbrk pages not counted as lazy\n", s);
+        exit(1);
+    }
+
+    // writes must get private pages, even after a read
+    // mapped the zero page.
+    for (i = 0; i < NPAGES; i += 2)
+        a[i * PGSIZE] = i;
+    for (i = 0; i < NPAGES; i++)
+    {
+        if (a[i * PGSIZE] != ((i % 2) == 0 ? i : 0))
+        {
+            printf("%s: page %d has wrong contents\n", s, i);
+            exit(1);
+        }
+    }
+
+    // the child gets a copy of the written pages, and zeros
+    // for the rest.
+    pid = fork();
+    if (pid < 0)
+    {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        for (i = 0; i < NPAGES; i++)
+            if (a[i * PGSIZE] != ((i % 2) == 0 ? i : 0))
+                exit(1);
+        a[PGSIZE] = 'c';
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0 || a[PGSIZE] != 0)
+    {
+        printf("%s: fork did not copy lazy heap\n", s);
+        exit(1);
+    }
+}
+
+// meminfo() sees pages this process touches as resident.
+void meminfotest(char *s)
+{
+    static struct meminfo mi;
+    uint64 rss0 = 0, rss1 = 0;
+    char *a;
+    int i, pid = getpid();
+
+    if (meminfo(&mi) < 0)
+    {
+        printf("%s: meminfo failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < mi.nproc; i++)
+        if (mi.proc[i].pid == pid)
+            rss0 = mi.proc[i].rss;
+    a = sbrk(64 * PGSIZE);
+    for (i = 0; i < 64; i++)
+        a[i * PGSIZE] = 1;
+    meminfo(&mi);
+    for (i = 0; i < mi.nproc; i++)
+        if (mi.proc[i].pid == pid)
+            rss1 = mi.proc[i].rss;
+    if (rss1 < rss0 + 64 || mi.free == 0 || mi.free >= mi.total)
+    {
+        printf("%s: rss %d -> %d, free %d of %d\n", s, (int)rss0, (int)rss1,
+               (int)mi.free, (int)mi.total);
+        exit(1);
+    }
+    sbrk(-64 * PGSIZE);
+}
+
+// a heap big enough for superpages keeps its contents across
+// fork() and across a shrink that splits a superpage.
+void superpage(char *s)
+{
+    enum
+    {
+        SUPER = 512 * PGSIZE
+    };
+    char *a, *old;
+    uint64 i;
+    int pid, xstatus;
+
+    old = sbrk(0);
+    a = sbrk(3 * SUPER);
+    if (a == (char *)0xffffffffffffffffL)
+    {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < 3 * SUPER; i += PGSIZE)
+        a[i] = i / PGSIZE;
+
+    pid = fork();
+    if (pid < 0)
+    {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        for (i = 0; i < 3 * SUPER; i += PGSIZE)
+            if (a[i] != (char)(i / PGSIZE))
+                exit(1);
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0)
+    {
+        printf("%s: fork did not copy superpages\n", s);
+        exit(1);
+    }
+
+    // cut the heap off in the middle of a 2 MB block, then
+    // a page short of the end of one.
+    if (sbrk(-(SUPER + SUPER / 2)) == (char *)0xffffffffffffffffL ||
+        sbrk(-(SUPER / 2 + PGSIZE)) == (char *)0xffffffffffffffffL)
+    {
+        printf("%s: sbrk shrink failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < SUPER - PGSIZE; i += PGSIZE)
+    {
+        if (a[i] != (char)(i / PGSIZE))
+        {
+            printf("%s: shrink lost contents\n", s);
+            exit(1);
+        }
+    }
+    sbrk(old - sbrk(0));
+}
+
+// mmap() of anonymous memory and of files, shared and private,
+// across fork(), with partial munmap().
+void mmaptest(char *s)
+{
+    char *a, *c, *f;
+    int fd, fd2, i, pid, xstatus;
+
+    // anonymous private memory is zero, and copy-on-write
+    // after fork.
+    a = mmap(0, 3 * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (a == MAP_FAILED)
+    {
+        printf("%s: mmap anonymous failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < 3 * PGSIZE; i += 512)
+    {
+        if (a[i] != 0)
+        {
+            printf("%s: anonymous page not zero\n", s);
+            exit(1);
+        }
+    }
+    a[0] = 'p';
+    pid = fork();
+    if (pid == 0)
+    {
+        if (a[0] != 'p')
+            exit(1);
+        a[0] = 'c';
+        a[PGSIZE] = 'c';
+        exit(a[0] == 'c' ? 0 : 1);
+    }
+    wait(&xstatus);
+    if (xstatus != 0 || a[0] != 'p' || a[PGSIZE] != 0)
+    {
+        printf("%s: private mapping not copied on write\n", s);
+        exit(1);
+    }
+
+    // unmapping the middle page splits the region.
+    if (munmap(a + PGSIZE, PGSIZE) != 0)
+    {
+        printf("%s: munmap failed\n", s);
+        exit(1);
+    }
+    a[2 * PGSIZE] = 'x';
+    pid = fork();
+    if (pid == 0)
+    {
+        a[PGSIZE] = 'x';
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != -1)
+    {
+        printf("%s: unmapped page still accessible\n", s);
+        exit(1);
+    }
+    munmap(a, PGSIZE);
+    munmap(a + 2 * PGSIZE, PGSIZE);
+
+    // anonymous shared memory is shared with the child.
+    a = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    pid = fork();
+    if (pid == 0)
+    {
+        a[100] = 'z';
+        exit(0);
+    }
+    wait(&xstatus);
+    if (a[100] != 'z')
+    {
+        printf("%s: shared mapping not shared\n", s);
+        exit(1);
+    }
+    munmap(a, PGSIZE);
+
+    // and isn't limited to the size of a one-level table.
+    a = mmap(0, 4 * 1024 * 1024, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (a == MAP_FAILED)
+    {
+        printf("%s: big shared mapping failed\n", s);
+        exit(1);
+    }
+    pid = fork();
+    if (pid == 0)
+    {
+        a[4 * 1024 * 1024 - 1] = 'y';
+        exit(0);
+    }
+    wait(&xstatus);
+    if (a[4 * 1024 * 1024 - 1] != 'y')
+    {
+        printf("%s: big shared mapping not shared\n", s);
+        exit(1);
+    }
+    munmap(a, 4 * 1024 * 1024);
+
+    // a shared file mapping writes back on munmap; a private
+    // one does not.
+    fd = open("mmapfile", O_CREATE | O_RDWR);
+    memset(buf, 'a', PGSIZE);
+    for (i = 0; i < 2; i++)
+    {
+        if (write(fd, buf, PGSIZE) != PGSIZE)
+        {
+            printf("%s: write mmapfile failed\n", s);
+            exit(1);
+        }
+    }
+    f = mmap(0, 2 * PGSIZE, PROT_READ, MAP_PRIVATE, fd, PGSIZE);
+    a = mmap(0, 2 * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (f == MAP_FAILED || a == MAP_FAILED)
+    {
+        printf("%s: mmap file failed\n", s);
+        exit(1);
+    }
+    if (f[0] != 'a' || f[PGSIZE] != 0 || a[PGSIZE + 1] != 'a')
+    {
+        printf("%s: wrong file contents\n", s);
+        exit(1);
+    }
+    a[0] = 'b';
+    a[PGSIZE + 1] = 'b';
+
+    // other shared mappings of the file map the same pages,
+    // and read() and write() see them before write-back.
+    pid = fork();
+    if (pid == 0)
+    {
+        c = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, PGSIZE);
+        if (c == MAP_FAILED || c[1] != 'b')
+            exit(1);
+        c[2] = 'c';
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0 || a[PGSIZE + 2] != 'c')
+    {
+        printf("%s: shared file mappings not shared\n", s);
+        exit(1);
+    }
+    fd2 = open("mmapfile", O_RDWR);
+    if (read(fd2, buf, 3) != 3 || buf[0] != 'b' || write(fd2, "d", 1) != 1 || a[3] != 'd')
+    {
+        printf("%s: read/write don't see shared file mapping\n", s);
+        exit(1);
+    }
+    close(fd2);
+
+    munmap(a, 2 * PGSIZE);
+    munmap(f, 2 * PGSIZE);
+    close(fd);
+    fd = open("mmapfile", O_RDONLY);
+    unlink("mmapfile");
+    if (read(fd, buf, 2 * PGSIZE) != 2 * PGSIZE ||
+        buf[0] != 'b' || buf[1] != 'a' || buf[3] != 'd' ||
+        buf[PGSIZE + 1] != 'b' || buf[PGSIZE + 2] != 'c')
+    {
+        printf("%s: shared mapping not written back\n", s);
+        exit(1);
+    }
+    close(fd);
+}
+
+void shmtest(char *s)
+{
+    char *a, *b;
+    int id, pid, xstatus;
+
+    id = shmget(4242, 2 * PGSIZE);
+    if (id < 0 || shmget(4242, PGSIZE) != id || shmget(4242, 3 * PGSIZE) >= 0)
+    {
+        printf("%s: shmget failed\n", s);
+        exit(1);
+    }
+    a = shmat(id);
+    b = shmat(id);
+    if (a == MAP_FAILED || b == MAP_FAILED || a == b)
+    {
+        printf("%s: shmat failed\n", s);
+        exit(1);
+    }
+    a[PGSIZE] = 'a';
+    if (b[PGSIZE] != 'a')
+    {
+        printf("%s: attachments not shared\n", s);
+        exit(1);
+    }
+
+    // an unrelated attachment in the child, found by key,
+    // sees the same pages.
+    pid = fork();
+    if (pid == 0)
+    {
+        shmdt(a);
+        shmdt(b);
+        a = shmat(shmget(4242, PGSIZE));
+        if (a == MAP_FAILED || a[PGSIZE] != 'a')
+            exit(1);
+        a[0] = 'c';
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0 || b[0] != 'c')
+    {
+        printf("%s: segment not shared with child\n", s);
+        exit(1);
+    }
+    if (shmdt(a + PGSIZE) == 0 || shmdt(a) != 0 || shmdt(b) != 0)
+    {
+        printf("%s: shmdt failed\n", s);
+        exit(1);
+    }
+
+    // the last detach removed the segment.
+    id = shmget(4242, PGSIZE);
+    a = shmat(id);
+    if (a == MAP_FAILED || a[PGSIZE - 1] != 0 || a[0] != 0)
+    {
+        printf("%s: segment outlived its attachments\n", s);
+        exit(1);
+    }
+    shmdt(a);
+
+    // a segment nobody attached goes when its creator exits,
+    // so the key can be made again, bigger.
+    pid = fork();
+    if (pid == 0)
+        exit(shmget(4243, PGSIZE) < 0);
+    wait(&xstatus);
+    if (xstatus != 0 || (id = shmget(4243, 2 * PGSIZE)) < 0)
+    {
+        printf("%s: unattached segment outlived its creator\n", s);
+        exit(1);
+    }
+    shmdt(shmat(id));
+}
+
 // regression test. test whether exec() leaks memory if one of the
 // arguments is invalid. the test passes if the kernel doesn't panic.
 void badarg(char *s)
@@ -2993,10 +3460,478 @@ void ulttest()
     exit(1);
 }
 
-void kthread_start_func(void)
+// thousands of uthreads, each yielding and then starting
+// another until NULT have run, on guarded, pooled stacks.
+enum
 {
-    for (int i = 0; i < 10; i++)
-    {
+    NULT = 4000
+};
+int ultcreated, ultdone;
+
+void ultmany_func(void)
+{
+    uthread_detach(uthread_self()->id);
+    for (int i = 0; i < 3; i++)
+        uthread_yield();
+    if (ultcreated < NULT)
+    {
+        if (uthread_create(ultmany_func, LOW) < 0)
+        {
+            printf("ultmany: uthread_create failed\n");
+            exit(1);
+        }
+        ultcreated++;
+    }
+    if (++ultdone == NULT)
+        exit(0);
+    uthread_exit();
+}
+
+void ultmany(char *s)
+{
+    uthread_set_guard(1);
+    uthread_set_stacksize(2048);
+    for (ultcreated = 0; ultcreated < NULT / 4; ultcreated++)
+    {
+        if (uthread_create(ultmany_func, LOW) < 0)
+        {
+            printf("%s: uthread_create failed\n", s);
+            exit(1);
+        }
+    }
+    uthread_start_all();
+    printf("%s: uthread_start_all failed\n", s);
+    exit(1);
+}
+
+// uthreads spread over several worker kthreads, which
+// steal them from one another.
+enum
+{
+    NWORKUT = 400
+};
+int workutdone, workutseen;
+
+void ultworkers_func(void)
+{
+    for (int i = 0; i < 50; i++)
+    {
+        __sync_fetch_and_or(&workutseen, 1 << (kthread_id() % 32));
+        uthread_yield();
+    }
+    if (__sync_add_and_fetch(&workutdone, 1) == NWORKUT)
+    {
+        // more than one bit: more than one kthread ran them.
+        if ((workutseen & (workutseen - 1)) == 0)
+        {
+            printf("ultworkers: all ran on one kthread\n");
+            exit(1);
+        }
+        exit(0);
+    }
+    uthread_exit();
+}
+
+void ultworkers(char *s)
+{
+    if (uthread_set_workers(4) < 0)
+    {
+        printf("%s: uthread_set_workers failed\n", s);
+        exit(1);
+    }
+    for (int i = 0; i < NWORKUT; i++)
+    {
+        if (uthread_create(ultworkers_func, LOW) < 0)
+        {
+            printf("%s: uthread_create failed\n", s);
+            exit(1);
+        }
+    }
+    uthread_start_all();
+    printf("%s: uthread_start_all failed\n", s);
+    exit(1);
+}
+
+// a uthread blocked reading an empty pipe lets the others
+// run: one sleeps and then writes to it, another keeps
+// yielding meanwhile.
+int ultiofds[2], ultiodone, ultiospins;
+
+void ultio_reader(void)
+{
+    char buf[8];
+
+    if (uthread_read(ultiofds[0], buf, sizeof(buf)) != 4 || memcmp(buf, "ping", 4) != 0)
+    {
+        printf("ultio: read wrong data\n");
+        exit(1);
+    }
+    if (ultiospins == 0)
+    {
+        printf("ultio: nothing ran while the reader was blocked\n");
+        exit(1);
+    }
+    ultiodone = 1;
+    uthread_exit();
+}
+
+void ultio_writer(void)
+{
+    uthread_sleep(3);
+    if (uthread_write(ultiofds[1], "ping", 4) != 4)
+    {
+        printf("ultio: write failed\n");
+        exit(1);
+    }
+    uthread_exit();
+}
+
+void ultio_spinner(void)
+{
+    while (!ultiodone)
+    {
+        ultiospins++;
+        uthread_yield();
+    }
+    exit(0);
+}
+
+void ultio(char *s)
+{
+    if (pipe(ultiofds) < 0)
+    {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    if (uthread_create(ultio_reader, HIGH) < 0 || uthread_create(ultio_writer, HIGH) < 0 ||
+        uthread_create(ultio_spinner, LOW) < 0)
+    {
+        printf("%s: uthread_create failed\n", s);
+        exit(1);
+    }
+    uthread_start_all();
+    printf("%s: uthread_start_all failed\n", s);
+    exit(1);
+}
+
+// uthread_join() waits for a thread that is still running and
+// reaps one that has exited; neither can be joined twice, nor
+// a detached one at all.
+int ultjoinval, ultjoinsleeper, ultjoinquick, ultjoindetached;
+
+void ultjoin_sleeper(void)
+{
+    uthread_sleep(2);
+    ultjoinval = 1;
+    uthread_exit();
+}
+
+void ultjoin_quick(void)
+{
+    uthread_exit();
+}
+
+void ultjoin_detached(void)
+{
+    for (int i = 0; i < 5; i++)
+        uthread_yield();
+    uthread_exit();
+}
+
+void ultjoin_joiner(void)
+{
+    if (uthread_join(ultjoinsleeper) != 0 || ultjoinval != 1)
+    {
+        printf("ultjoin: join of a running thread failed\n");
+        exit(1);
+    }
+    if (uthread_join(ultjoinquick) != 0)
+    {
+        printf("ultjoin: join of an exited thread failed\n");
+        exit(1);
+    }
+    if (uthread_join(ultjoinsleeper) != -1 || uthread_join(ultjoindetached) != -1 ||
+        uthread_join(uthread_self()->id) != -1)
+    {
+        printf("ultjoin: bad join succeeded\n");
+        exit(1);
+    }
+    exit(0);
+}
+
+void ultjoin(char *s)
+{
+    if (uthread_create(ultjoin_joiner, LOW) < 0 ||
+        (ultjoinsleeper = uthread_create(ultjoin_sleeper, LOW)) < 0 ||
+        (ultjoinquick = uthread_create(ultjoin_quick, HIGH)) < 0 ||
+        (ultjoindetached = uthread_create(ultjoin_detached, LOW)) < 0)
+    {
+        printf("%s: uthread_create failed\n", s);
+        exit(1);
+    }
+    if (uthread_detach(ultjoindetached) != 0)
+    {
+        printf("%s: uthread_detach failed\n", s);
+        exit(1);
+    }
+    uthread_start_all();
+    printf("%s: uthread_start_all failed\n", s);
+    exit(1);
+}
+
+// uthreads on several workers, yielding while they hold a
+// umutex, still count correctly; a ucond wakes the checker
+// once they are done, and values sent on two channels all
+// arrive through uchan_select(), which sees them closed.
+#define ULTSYNCN 8
+#define ULTSYNCITERS 500
+
+struct umutex ultsyncmu;
+struct ucond ultsyncdone;
+struct uchan *ultsyncch[2];
+int ultsynccount, ultsyncfinished, ultsyncsenders;
+
+void ultsync_counter(void)
+{
+    for (int i = 0; i < ULTSYNCITERS; i++)
+    {
+        umutex_lock(&ultsyncmu);
+        int c = ultsynccount;
+        if (i % 5 == 0)
+            uthread_yield();
+        ultsynccount = c + 1;
+        umutex_unlock(&ultsyncmu);
+    }
+    umutex_lock(&ultsyncmu);
+    ultsyncfinished++;
+    ucond_signal(&ultsyncdone);
+    umutex_unlock(&ultsyncmu);
+    uthread_exit();
+}
+
+void ultsync_sender(void)
+{
+    struct uchan *c = ultsyncch[__sync_fetch_and_add(&ultsyncsenders, 1)];
+
+    for (uint64 i = 1; i <= 100; i++)
+        uchan_send(c, (void *)i);
+    uchan_close(c);
+    uthread_exit();
+}
+
+void ultsync_checker(void)
+{
+    struct uselect sel[2];
+    uint64 sum = 0;
+    int i, open = 2;
+
+    umutex_lock(&ultsyncmu);
+    while (ultsyncfinished < ULTSYNCN)
+        ucond_wait(&ultsyncdone, &ultsyncmu);
+    umutex_unlock(&ultsyncmu);
+    if (ultsynccount != ULTSYNCN * ULTSYNCITERS)
+    {
+        printf("ultsync: count %d, not %d\n", ultsynccount, ULTSYNCN * ULTSYNCITERS);
+        exit(1);
+    }
+
+    while (open > 0)
+    {
+        for (i = 0; i < 2; i++)
+        {
+            sel[i].chan = ultsyncch[i];
+            sel[i].op = URECV;
+        }
+        i = uchan_select(sel, 2, 1);
+        if (i < 0)
+        {
+            printf("ultsync: uchan_select failed\n");
+            exit(1);
+        }
+        if (!sel[i].ok)
+        {
+            // a closed channel stays ready; stop selecting it.
+            open--;
+            ultsyncch[i] = uchan_new(0);
+            continue;
+        }
+        sum += (uint64)sel[i].val;
+    }
+    if (sum != 2 * 5050)
+    {
+        printf("ultsync: received %d, not %d\n", (int)sum, 2 * 5050);
+        exit(1);
+    }
+    exit(0);
+}
+
+void ultsync(char *s)
+{
+    int i;
+
+    uthread_set_workers(4);
+    umutex_init(&ultsyncmu);
+    ucond_init(&ultsyncdone);
+    if ((ultsyncch[0] = uchan_new(0)) == 0 || (ultsyncch[1] = uchan_new(4)) == 0)
+    {
+        printf("%s: uchan_new failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < ULTSYNCN; i++)
+        if (uthread_create(ultsync_counter, i % 3) < 0)
+            break;
+    if (i < ULTSYNCN || uthread_create(ultsync_checker, LOW) < 0 ||
+        uthread_create(ultsync_sender, MEDIUM) < 0 || uthread_create(ultsync_sender, HIGH) < 0)
+    {
+        printf("%s: uthread_create failed\n", s);
+        exit(1);
+    }
+    uthread_start_all();
+    printf("%s: uthread_start_all failed\n", s);
+    exit(1);
+}
+
+// a coroutine pipeline yields the right values, a finished
+// coroutine's result reaches its caller and it can't be
+// resumed again, and pipelines still work inside uthreads
+// that are preempted and move between workers.
+void *coro_counter(struct coro *self, void *val)
+{
+    for (uint64 i = (uint64)val;; i++)
+        coro_yield_value(self, (void *)i);
+    return 0;
+}
+
+void *coro_evens(struct coro *self, void *val)
+{
+    struct coro *src = val;
+    uint64 v;
+
+    for (;;)
+    {
+        v = (uint64)coro_resume(src, 0);
+        if (v % 2 == 0)
+            coro_yield_value(self, (void *)v);
+    }
+    return 0;
+}
+
+void *coro_adder(struct coro *self, void *val)
+{
+    uint64 sum = 0;
+
+    while (val)
+    {
+        sum += (uint64)val;
+        val = coro_yield_value(self, (void *)sum);
+    }
+    return (void *)(sum + 1000);
+}
+
+// check n values of an evens-of-a-counter pipeline.
+int coro_pipeline(int n, uint stacksize)
+{
+    struct coro *src, *c;
+    int ok = 1;
+
+    if ((src = coro_create(coro_counter, stacksize)) == 0 || (c = coro_create(coro_evens, stacksize)) == 0)
+        return 0;
+    coro_resume(src, (void *)1); // start counting at 1
+    for (uint64 i = 1; i <= n; i++)
+        if ((uint64)coro_resume(c, src) != 2 * i)
+            ok = 0;
+    coro_free(c);
+    coro_free(src);
+    return ok;
+}
+
+int corodone;
+
+void coro_uthread(void)
+{
+    if (!coro_pipeline(20000, 0))
+    {
+        printf("coro: pipeline in a uthread failed\n");
+        exit(1);
+    }
+    if (__sync_add_and_fetch(&corodone, 1) == 4)
+        exit(0);
+    uthread_exit();
+}
+
+void coro(char *s)
+{
+    struct coro *c;
+
+    // tiny stacks will do with no preemption; the uthreads
+    // below take the default, which leaves room for it.
+    if (!coro_pipeline(100, 256))
+    {
+        printf("%s: pipeline failed\n", s);
+        exit(1);
+    }
+    if ((c = coro_create(coro_adder, 0)) == 0)
+    {
+        printf("%s: coro_create failed\n", s);
+        exit(1);
+    }
+    if ((uint64)coro_resume(c, (void *)1) != 1 || (uint64)coro_resume(c, (void *)2) != 3 || coro_done(c) ||
+        (uint64)coro_resume(c, 0) != 1003 || !coro_done(c) || coro_resume(c, (void *)5) != 0)
+    {
+        printf("%s: wrong values\n", s);
+        exit(1);
+    }
+    coro_free(c);
+
+    uthread_set_workers(2);
+    uthread_set_quantum(1);
+    for (int i = 0; i < 4; i++)
+    {
+        if (uthread_create(coro_uthread, i % 3) < 0)
+        {
+            printf("%s: uthread_create failed\n", s);
+            exit(1);
+        }
+    }
+    uthread_start_all();
+    printf("%s: uthread_start_all failed\n", s);
+    exit(1);
+}
+
+// a HIGH uthread that spins without yielding is preempted,
+// so a LOW one on the same worker gets to stop it.
+volatile int ultspin;
+
+void ultpreempt_hog(void)
+{
+    while (ultspin == 0)
+        ;
+    exit(0);
+}
+
+void ultpreempt_stopper(void)
+{
+    ultspin = 1;
+    uthread_exit();
+}
+
+void ultpreempt(char *s)
+{
+    uthread_set_quantum(1);
+    if (uthread_create(ultpreempt_hog, HIGH) < 0 || uthread_create(ultpreempt_stopper, LOW) < 0)
+    {
+        printf("%s: uthread_create failed\n", s);
+        exit(1);
+    }
+    uthread_start_all();
+    printf("%s: uthread_start_all failed\n", s);
+    exit(1);
+}
+
+void kthread_start_func(void)
+{
+    for (int i = 0; i < 10; i++)
+    {
         sleep(10); // simulate work
     }
     kthread_exit(0);
@@ -3033,6 +3968,86 @@ void klttest()
     free((void *)stack_b);
 }
 
+// kthreads that malloc() and free() at the same time don't
+// hand out the same block twice.
+static volatile int mallocbad;
+
+void mallocthread(void)
+{
+    char *p[32];
+    int i, j, id = kthread_id() & 0x7f;
+
+    for (i = 0; i < 1000; i++)
+    {
+        for (j = 0; j < 32; j++)
+        {
+            if ((p[j] = malloc(1 + (i + j) % 300)) == 0)
+                break;
+            p[j][0] = id;
+        }
+        while (--j >= 0)
+        {
+            if (p[j][0] != id)
+                mallocbad = 1;
+            free(p[j]);
+        }
+    }
+    kthread_exit(0);
+}
+
+void mallocthreads(char *s)
+{
+    enum
+    {
+        N = 4,
+        STK = 8192
+    };
+    char *stack[N];
+    int i, tid[N];
+
+    mallocbad = 0;
+    for (i = 0; i < N; i++)
+    {
+        stack[i] = malloc(STK);
+        tid[i] = kthread_create((void *(*)())mallocthread, stack[i], STK);
+        if (tid[i] <= 0)
+        {
+            printf("%s: kthread_create failed\n", s);
+            exit(1);
+        }
+    }
+    for (i = 0; i < N; i++)
+        kthread_join(tid[i], 0);
+    for (i = 0; i < N; i++)
+        free(stack[i]);
+    if (mallocbad)
+    {
+        printf("%s: two threads got the same block\n", s);
+        exit(1);
+    }
+}
+
+// free() gives a big block at the end of the heap back to
+// the kernel.
+void malloctrimtest(char *s)
+{
+    uint64 released = mallocreleased();
+    char *a, *end;
+
+    if ((a = malloc(1024 * 1024)) == 0)
+    {
+        printf("%s: malloc failed\n", s);
+        exit(1);
+    }
+    end = sbrk(0);
+    free(a);
+    if (sbrk(0) >= end || mallocreleased() < released + 1024 * 1024)
+    {
+        printf("%s: heap not shrunk\n", s);
+        exit(1);
+    }
+}
+
 struct test
 {
     void (*f)(char *);
@@ -3040,6 +4055,7 @@ struct test
 } quicktests[] = {
     {copyin, "copyin"},
     {copyout, "copyout"},
+    {copyfault, "copyfault"},
     {copyinstr1, "copyinstr1"},
     {copyinstr2, "copyinstr2"},
     {copyinstr3, "copyinstr3"},
@@ -3096,10 +4112,24 @@ struct test
     {pgbug, "pgbug"},
     {sbrkbugs, "sbrkbugs"},
     {sbrklast, "sbrklast"},
+    {sbrklazy, "sbrklazy"},
+    {superpage, "superpage"},
+    {meminfotest, "meminfo"},
+    {mmaptest, "mmaptest"},
+    {shmtest, "shmtest"},
     {sbrk8000, "sbrk8000"},
     {badarg, "badarg"},
     {ulttest, "ulttest"},
+    {ultmany, "ultmany"},
+    {ultworkers, "ultworkers"},
+    {ultio, "ultio"},
+    {ultpreempt, "ultpreempt"},
+    {ultjoin, "ultjoin"},
+    {ultsync, "ultsync"},
+    {coro, "coro"},
     {klttest, "klttest"},
+    {mallocthreads, "mallocthreads"},
+    {malloctrimtest, "malloctrim"},
 
     {0, 0},
 };
@@ -3421,6 +4451,45 @@ void outofinodes(char *s)
     }
 }
 
+// a heap larger than physical memory works, paging through
+// swap, and reads back what was written.
+void swapout(char *s)
+{
+    struct vmstat st0, st1;
+    uint64 i, n = PHYSTOP - KERNBASE + 8 * 1024 * 1024;
+    char *a;
+
+    vmstat(&st0);
+    if (st0.swap_slots * PGSIZE < 16 * 1024 * 1024)
+    {
+        printf("%s: not enough swap, skipping\n", s);
+        return;
+    }
+    a = sbrk(n);
+    if (a == (char *)0xffffffffffffffffL)
+    {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < n; i += PGSIZE)
+        *(uint64 *)(a + i) = i;
+    for (i = 0; i < n; i += PGSIZE)
+    {
+        if (*(uint64 *)(a + i) != i)
+        {
+            printf("%s: page %p came back wrong\n", s, a + i);
+            exit(1);
+        }
+    }
+    vmstat(&st1);
+    if (st1.swap_outs == st0.swap_outs || st1.swap_ins == st0.swap_ins)
+    {
+        printf("%s: nothing went through swap\n", s);
+        exit(1);
+    }
+    sbrk(-n);
+}
+
 struct test slowtests[] = {
     {bigdir, "bigdir"},
     {manywrites, "manywrites"},
@@ -3428,6 +4497,7 @@ struct test slowtests[] = {
     {execout, "execout"},
     {diskfull, "diskfull"},
     {outofinodes, "outofinodes"},
+    {swapout, "swapout"},
 
     {0, 0},
 };
@@ -0,0 +1,451 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "uthread.h"
+
+// Mutexes, condition variables, semaphores and channels for
+// uthreads, with no system calls.
+//
+// A thread that has to wait puts a struct uwaiter, on its own
+// stack, on the object's queue and parks in uthread_wait(),
+// off every run queue. The thread that makes it able to go
+// on hands it what it waited for directly: the mutex, still
+// locked, a unit of the semaphore, or a channel's value. So a
+// woken thread never has to try again, and can't lose what it
+// was given to a thread that gets there first.
+//
+// uchan_select() waits on several channels at once, with a
+// waiter on each sharing one wait state: the first waker to
+// claim that state completes its case, and wakers that find
+// one of the others drop it. A select locks all its channels,
+// in address order, to look for a case that is ready and
+// queue its waiters, so that nothing can become ready in
+// between; other operations lock one channel.
+//
+// Each object's spinlock is held with preemption off, so a
+// preempted thread can't leave it held.
+
+struct uwaiter {
+    struct uthread *t;
+    int *state;               // shared by a select's waiters
+    int *which;               // select: where to say which case fired
+    int index;                // and this one's index
+    struct uselect *sel;      // channel operation, or 0
+    struct uwaiter *next, *prev;
+    int queued;
+};
+
+static void lock(int *l)
+{
+    preempt_off();
+    while (__sync_lock_test_and_set(l, 1) != 0)
+        ;
+    __sync_synchronize();
+}
+
+static void unlock(int *l)
+{
+    __sync_lock_release(l);
+    preempt_on();
+}
+
+static void qput(struct uwaitq *q, struct uwaiter *wt)
+{
+    wt->next = 0;
+    wt->prev = q->tail;
+    if (q->tail)
+        q->tail->next = wt;
+    else
+        q->head = wt;
+    q->tail = wt;
+    wt->queued = 1;
+}
+
+static void qremove(struct uwaitq *q, struct uwaiter *wt)
+{
+    if (wt->prev)
+        wt->prev->next = wt->next;
+    else
+        q->head = wt->next;
+    if (wt->next)
+        wt->next->prev = wt->prev;
+    else
+        q->tail = wt->prev;
+    wt->queued = 0;
+}
+
+// Take the first waiter on q that can still be woken, and
+// claim it, dropping those a select has been woken from
+// another way. Returns 0 if there is none. Caller holds the
+// lock of q's object.
+static struct uwaiter *qclaim(struct uwaitq *q)
+{
+    struct uwaiter *wt;
+
+    while ((wt = q->head) != 0)
+    {
+        qremove(q, wt);
+        if (uthread_claim(wt->state))
+            return wt;
+    }
+    return 0;
+}
+
+// Wake claimed waiter wt, which can go as soon as it is.
+static void fire(struct uwaiter *wt)
+{
+    if (wt->which)
+        *wt->which = wt->index;
+    uthread_wake(wt->state, wt->t);
+}
+
+// Queue the calling thread on q as waiting on *state.
+static void waiter(struct uwaiter *wt, int *state, struct uwaitq *q)
+{
+    wt->t = uthread_self();
+    wt->state = state;
+    wt->which = 0;
+    wt->sel = 0;
+    qput(q, wt);
+}
+
+void umutex_init(struct umutex *m)
+{
+    memset(m, 0, sizeof(*m));
+}
+
+void umutex_lock(struct umutex *m)
+{
+    struct uwaiter wt;
+    int state = UW_WAITING;
+
+    lock(&m->lock);
+    if (!m->locked)
+    {
+        m->locked = 1;
+        unlock(&m->lock);
+        return;
+    }
+    waiter(&wt, &state, &m->q);
+    unlock(&m->lock);
+    uthread_wait(&state); // umutex_unlock() hands m over locked
+}
+
+// Lock m if no one has. Returns 0 if it did.
+int umutex_trylock(struct umutex *m)
+{
+    int r = -1;
+
+    lock(&m->lock);
+    if (!m->locked)
+    {
+        m->locked = 1;
+        r = 0;
+    }
+    unlock(&m->lock);
+    return r;
+}
+
+// Unlock m, or hand it to the first thread waiting for it.
+void umutex_unlock(struct umutex *m)
+{
+    struct uwaiter *wt;
+
+    lock(&m->lock);
+    if ((wt = qclaim(&m->q)) == 0)
+        m->locked = 0;
+    unlock(&m->lock);
+    if (wt)
+        fire(wt);
+}
+
+void ucond_init(struct ucond *c)
+{
+    memset(c, 0, sizeof(*c));
+}
+
+// Unlock m, wait for c to be signalled, and lock m again.
+void ucond_wait(struct ucond *c, struct umutex *m)
+{
+    struct uwaiter wt;
+    int state = UW_WAITING;
+
+    lock(&c->lock);
+    waiter(&wt, &state, &c->q);
+    unlock(&c->lock);
+    umutex_unlock(m);
+    uthread_wait(&state);
+    umutex_lock(m);
+}
+
+void ucond_signal(struct ucond *c)
+{
+    struct uwaiter *wt;
+
+    lock(&c->lock);
+    wt = qclaim(&c->q);
+    unlock(&c->lock);
+    if (wt)
+        fire(wt);
+}
+
+void ucond_broadcast(struct ucond *c)
+{
+    struct uwaiter *wt, *all = 0;
+
+    lock(&c->lock);
+    while ((wt = qclaim(&c->q)) != 0)
+    {
+        wt->next = all;
+        all = wt;
+    }
+    unlock(&c->lock);
+    for (; all; all = wt)
+    {
+        wt = all->next; // before all can go
+        fire(all);
+    }
+}
+
+void usem_init(struct usem *s, int count)
+{
+    memset(s, 0, sizeof(*s));
+    s->count = count;
+}
+
+void usem_down(struct usem *s)
+{
+    struct uwaiter wt;
+    int state = UW_WAITING;
+
+    lock(&s->lock);
+    if (s->count > 0)
+    {
+        s->count--;
+        unlock(&s->lock);
+        return;
+    }
+    waiter(&wt, &state, &s->q);
+    unlock(&s->lock);
+    uthread_wait(&state); // usem_up() hands over its unit
+}
+
+void usem_up(struct usem *s)
+{
+    struct uwaiter *wt;
+
+    lock(&s->lock);
+    if ((wt = qclaim(&s->q)) == 0)
+        s->count++;
+    unlock(&s->lock);
+    if (wt)
+        fire(wt);
+}
+
+// A channel that holds up to cap values; with cap 0, a send
+// waits for a receiver to take its value. Returns 0 if out of
+// memory.
+struct uchan *uchan_new(int cap)
+{
+    struct uchan *c;
+
+    if (cap < 0 || (c = malloc(sizeof(*c) + cap * sizeof(void *))) == 0)
+        return 0;
+    memset(c, 0, sizeof(*c));
+    c->buf = (void **)(c + 1);
+    c->cap = cap;
+    return c;
+}
+
+void uchan_free(struct uchan *c)
+{
+    free(c);
+}
+
+// Do case sel on its channel if that won't wait, waking the
+// waiter it completes. Returns 0 if it would wait. Caller
+// holds the channel's lock.
+static int trycase(struct uselect *sel)
+{
+    struct uchan *c = sel->chan;
+    struct uwaiter *wt;
+
+    sel->ok = 1;
+    if (sel->op == USEND)
+    {
+        if (c->closed)
+        {
+            sel->ok = 0;
+            return 1;
+        }
+        if ((wt = qclaim(&c->recvq)) != 0)
+        {
+            wt->sel->val = sel->val;
+            wt->sel->ok = 1;
+            fire(wt);
+            return 1;
+        }
+        if (c->n == c->cap)
+            return 0;
+        c->buf[(c->head + c->n++) % c->cap] = sel->val;
+        return 1;
+    }
+    if (c->n > 0)
+    {
+        sel->val = c->buf[c->head];
+        c->head = (c->head + 1) % c->cap;
+        c->n--;
+        // make room for a waiting sender's value.
+        if ((wt = qclaim(&c->sendq)) != 0)
+        {
+            c->buf[(c->head + c->n++) % c->cap] = wt->sel->val;
+            wt->sel->ok = 1;
+            fire(wt);
+        }
+        return 1;
+    }
+    if ((wt = qclaim(&c->sendq)) != 0)
+    {
+        sel->val = wt->sel->val;
+        wt->sel->ok = 1;
+        fire(wt);
+        return 1;
+    }
+    if (c->closed)
+    {
+        sel->ok = 0;
+        sel->val = 0;
+        return 1;
+    }
+    return 0;
+}
+
+// Do the first of the n (at most NSELECT) cases that can go
+// ahead, waiting for one to if block is set. Returns its
+// index, or -1 if none can and block isn't set. A case on a
+// closed channel goes ahead with ok 0.
+int uchan_select(struct uselect *cases, int n, int block)
+{
+    struct uchan *order[NSELECT], *c;
+    struct uwaiter wt[NSELECT];
+    int i, j, nc = 0, which = -1, queued, state = UW_WAITING;
+
+    if (n < 1 || n > NSELECT)
+        return -1;
+    // the channels, in address order, each once.
+    for (i = 0; i < n; i++)
+    {
+        c = cases[i].chan;
+        for (j = nc; j > 0 && order[j - 1] > c; j--)
+            order[j] = order[j - 1];
+        if (j > 0 && order[j - 1] == c)
+        {
+            for (; j < nc; j++)
+                order[j] = order[j + 1];
+            continue;
+        }
+        order[j] = c;
+        nc++;
+    }
+    for (i = 0; i < nc; i++)
+        lock(&order[i]->lock);
+    for (i = 0; i < n && which < 0; i++)
+        if (trycase(&cases[i]))
+            which = i;
+    if (which < 0 && block)
+    {
+        for (i = 0; i < n; i++)
+        {
+            c = cases[i].chan;
+            waiter(&wt[i], &state, cases[i].op == USEND ? &c->sendq : &c->recvq);
+            wt[i].which = &which;
+            wt[i].index = i;
+            wt[i].sel = &cases[i];
+        }
+    }
+    queued = which < 0 && block; // a waker may set which from now on
+    for (i = nc - 1; i >= 0; i--)
+        unlock(&order[i]->lock);
+    if (!queued)
+        return which;
+
+    uthread_wait(&state);
+    // take the waiters no waker took off their queues.
+    for (i = 0; i < n; i++)
+    {
+        c = cases[i].chan;
+        lock(&c->lock);
+        if (wt[i].queued)
+            qremove(cases[i].op == USEND ? &c->sendq : &c->recvq, &wt[i]);
+        unlock(&c->lock);
+    }
+    return which;
+}
+
+// Do case sel, waiting until it can go ahead: a select of
+// one, without the stack space for NSELECT waiters.
+static void chanop(struct uselect *sel)
+{
+    struct uchan *c = sel->chan;
+    struct uwaiter wt;
+    int state = UW_WAITING;
+
+    lock(&c->lock);
+    if (trycase(sel))
+    {
+        unlock(&c->lock);
+        return;
+    }
+    waiter(&wt, &state, sel->op == USEND ? &c->sendq : &c->recvq);
+    wt.sel = sel;
+    unlock(&c->lock);
+    uthread_wait(&state); // the waker took wt off the queue
+}
+
+// Send val on c, waiting for room. Returns -1 if c is closed.
+int uchan_send(struct uchan *c, void *val)
+{
+    struct uselect sel;
+
+    sel.chan = c;
+    sel.op = USEND;
+    sel.val = val;
+    chanop(&sel);
+    return sel.ok ? 0 : -1;
+}
+
+// Receive a value from c into *val, waiting for one. Returns
+// -1 if c is closed and empty.
+int uchan_recv(struct uchan *c, void **val)
+{
+    struct uselect sel;
+
+    sel.chan = c;
+    sel.op = URECV;
+    chanop(&sel);
+    *val = sel.val;
+    return sel.ok ? 0 : -1;
+}
+
+// Close c: sends fail from now on, and receives do once it is
+// empty, waking the threads waiting for either.
+void uchan_close(struct uchan *c)
+{
+    struct uwaiter *wt, *all = 0;
+
+    lock(&c->lock);
+    c->closed = 1;
+    while ((wt = qclaim(&c->recvq)) != 0 || (wt = qclaim(&c->sendq)) != 0)
+    {
+        wt->sel->ok = 0;
+        wt->sel->val = 0;
+        wt->next = all;
+        all = wt;
+    }
+    unlock(&c->lock);
+    for (; all; all = wt)
+    {
+        wt = all->next;
+        fire(all);
+    }
+}
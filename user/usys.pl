@@ -41,3 +41,15 @@ entry("kthread_id");
 entry("kthread_kill");
 entry("kthread_exit");
 entry("kthread_join");
+entry("vmstat");
+entry("vmtune");
+entry("mmap");
+entry("munmap");
+entry("shmget");
+entry("shmat");
+entry("shmdt");
+entry("meminfo");
+entry("faultstat");
+entry("poll");
+entry("sigalarm");
+entry("sigreturn");
@@ -1,97 +1,947 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
+#include "kernel/poll.h"
 #include "uthread.h"
 
+// User threads, run by workers: uthread_start_all() makes
+// the calling kthread one, and starts more kthreads to be the
+// others if uthread_set_workers() asked for them. Each thread
+// is malloc()ed together with its stack, so there is no limit
+// on how many there are but memory.
+//
+// Each worker keeps its runnable threads in a deque for each
+// priority, with a bitmap of the deques that aren't empty, so
+// it finds the next thread to run in constant time however
+// many there are. It runs threads from the front of its own
+// deques, and a worker with none steals from the back of
+// another's. Priorities order the threads of one worker only.
+//
+// A thread switches straight to the next one with uswtch(),
+// or to its worker's idle loop if there is none. Another
+// worker mustn't run it before that switch has saved its
+// registers, so it is the thread switched to that queues it
+// again, in finish(). Likewise, a thread that exits can't
+// free its own stack while it runs on it, so finish() puts
+// it in the pool, where uthread_create() looks for a stack
+// of the size it wants before it allocates.
+//
+// uthread_sleep(), uthread_join() and the I/O wrappers block
+// just the calling thread: it parks, and finish() files it
+// once it is switched out, in a heap of sleepers by wake-up
+// time, a list of threads waiting for files, or with the
+// thread it joins. Parked threads are on no run queue, so
+// the scheduler never looks at them. poller() wakes sleepers
+// whose time is up and waiters whose file poll() finds ready.
+// Busy workers call it every POLL_EVERY yields, and an idle
+// one calls it to wait in poll() for the first. An exited
+// thread stays a ZOMBIE, in the table of ids, until joined,
+// unless it was detached.
+//
+// With a quantum set, each worker takes a sigalarm() upcall
+// every tick it spends in user code, and preempt() switches
+// from a thread that has run for a quantum without switching
+// to the next one, as if it had yielded; it resumes from the
+// upcall's saved registers when next run. The library and
+// malloc() keep preemption off with preempt_off() while they
+// use a worker's state, and every switch happens with it off
+// exactly once, so the thread switched to turns it back on.
+//
+// A guarded thread's stack starts with GUARD_SIZE bytes of a
+// known pattern, checked whenever the thread switches away,
+// to catch an overflow before it does more damage.
+
 void update_priorities();
 
-struct uthread threads[MAX_UTHREADS];
-struct uthread *curr_thread;
+struct worker {
+    int lock;
+    struct uthread *runq[HIGH + 1];      // runnable, by priority
+    struct uthread *runqtail[HIGH + 1];
+    uint runqmap;                        // bit p: runq[p] isn't empty
+    struct uthread *curr;                // running now
+    struct uthread *prev;                // switched from; see finish()
+    struct uthread idle;                 // the worker's own context
+    int npoll;                           // yields until poller() is due
+    int ran;                             // ticks curr has run for
+    struct tls *tls;                     // its kthread's; see worker_main()
+};
+
+// parked threads.
+struct {
+    int lock;
+    struct uthread **timers; // in uthread_sleep(): a min-heap by wake
+    int ntimers;
+    int timercap;            // room for every thread
+    struct uthread *io;      // waiting for files
+    int polling;             // a worker is in poller(), using
+    struct pollfd fds[NPOLL];   // its poll() set, here rather than
+    struct uthread *ts[NPOLL];  // on a stack preempt() interrupted
+} waitq;
+
+// threads that haven't been reaped, by id.
+static int idlock;
+static struct uthread *ids[NIDHASH];
+static int nextid;
 
+static struct worker workers[MAX_WORKERS];
+static int nworkers = 1;
+static int nstarted;
 static int num_threads = 0;
+
+static int poollock;
+static struct uthread *pool;     // exited threads, for reuse
+static int npool;
+
 static int started = 0;
+static uint stacksize = STACK_SIZE;
+static int guard = 0;
+static int quantum = 0;          // ticks before preemption, or 0
 
-int uthread_create(void (*start_func)(), enum sched_priority priority)
+#define GUARD_BYTE 0xa5
+#define IDLESPIN 100000  // idle steal attempts before sleeping
+
+static void lock(int *l)
+{
+    while (__sync_lock_test_and_set(l, 1) != 0)
+        ;
+    __sync_synchronize();
+}
+
+static void unlock(int *l)
+{
+    __sync_lock_release(l);
+}
+
+// The worker the calling kthread is, or 0.
+static struct worker *myworker(void)
+{
+    struct tls *t = tls();
+
+    return t ? t->worker : 0;
+}
+
+static void checkguard(struct uthread *t)
 {
-    if (num_threads >= MAX_UTHREADS)
+    for (int i = 0; t->guarded && i < GUARD_SIZE; i++)
     {
-        return -1; // table is full
+        if ((uchar)t->ustack[i] != GUARD_BYTE)
+        {
+            fprintf(2, "uthread: stack overflow\n");
+            exit(1);
+        }
     }
+}
+
+// Queue t on w to run after the others of its priority.
+static void enqueue(struct worker *w, struct uthread *t)
+{
+    int p = t->priority;
 
-    // find a free entry in the table
-    int i;
-    for (i = 0; i < MAX_UTHREADS; i++)
+    t->state = RUNNABLE;
+    t->next = 0;
+    lock(&w->lock);
+    if (w->runq[p])
+    {
+        t->prev = w->runqtail[p];
+        w->runqtail[p]->next = t;
+    }
+    else
+    {
+        t->prev = 0;
+        w->runq[p] = t;
+    }
+    w->runqtail[p] = t;
+    w->runqmap |= 1 << p;
+    unlock(&w->lock);
+}
+
+static const int highest[8] = {-1, LOW, MEDIUM, MEDIUM, HIGH, HIGH, HIGH, HIGH};
+
+// Take the runnable thread of highest priority off the front
+// of w's deques if own, else off the back. Returns 0 if w has
+// none.
+static struct uthread *dequeue(struct worker *w, int own)
+{
+    struct uthread *t;
+    int p;
+
+    lock(&w->lock);
+    if ((p = highest[w->runqmap]) < 0)
+    {
+        unlock(&w->lock);
+        return 0;
+    }
+    if (own)
     {
-        if (threads[i].state == FREE)
+        t = w->runq[p];
+        if ((w->runq[p] = t->next) != 0)
+            t->next->prev = 0;
+    }
+    else
+    {
+        t = w->runqtail[p];
+        if ((w->runqtail[p] = t->prev) != 0)
+            t->prev->next = 0;
+        else
+            w->runq[p] = 0;
+    }
+    if (w->runq[p] == 0)
+        w->runqmap &= ~(1 << p);
+    unlock(&w->lock);
+    return t;
+}
+
+// The next thread for w to run, its own or stolen, or 0.
+static struct uthread *scheduler(struct worker *w)
+{
+    struct uthread *t;
+    int i, n = nworkers;
+
+    if ((t = dequeue(w, 1)) != 0)
+        return t;
+    for (i = 1; i < n; i++)
+        if ((t = dequeue(&workers[(w - workers + i) % n], 0)) != 0)
+            return t;
+    return 0;
+}
+
+// Add t to the heap of sleepers. Caller holds waitq.lock.
+static void timerpush(struct uthread *t)
+{
+    struct uthread **h = waitq.timers;
+    int i, parent;
+
+    for (i = waitq.ntimers++; i > 0; i = parent)
+    {
+        parent = (i - 1) / 2;
+        if (h[parent]->wake <= t->wake)
+            break;
+        h[i] = h[parent];
+    }
+    h[i] = t;
+}
+
+// Take the first sleeper to wake off the heap. Caller holds
+// waitq.lock.
+static struct uthread *timerpop(void)
+{
+    struct uthread **h = waitq.timers;
+    struct uthread *t = h[0], *last = h[--waitq.ntimers];
+    int i, child, n = waitq.ntimers;
+
+    for (i = 0; (child = 2 * i + 1) < n; i = child)
+    {
+        if (child + 1 < n && h[child + 1]->wake < h[child]->wake)
+            child++;
+        if (last->wake <= h[child]->wake)
+            break;
+        h[i] = h[child];
+    }
+    h[i] = last;
+    return t;
+}
+
+// Make room in the heap of sleepers for n threads. Returns -1
+// if out of memory.
+static int growtimers(int n)
+{
+    struct uthread **h, **old = 0;
+    int cap;
+
+    lock(&waitq.lock);
+    if (n <= waitq.timercap)
+    {
+        unlock(&waitq.lock);
+        return 0;
+    }
+    cap = waitq.timercap ? 2 * waitq.timercap : 64;
+    if (cap < n)
+        cap = n;
+    if ((h = malloc(cap * sizeof(*h))) == 0)
+    {
+        unlock(&waitq.lock);
+        return -1;
+    }
+    if (waitq.ntimers > 0)
+        memmove(h, waitq.timers, waitq.ntimers * sizeof(*h));
+    old = waitq.timers;
+    waitq.timers = h;
+    waitq.timercap = cap;
+    unlock(&waitq.lock);
+    free(old);
+    return 0;
+}
+
+static struct uthread **idslot(int id)
+{
+    struct uthread **pp;
+
+    for (pp = &ids[id % NIDHASH]; *pp && (*pp)->id != id; pp = &(*pp)->hnext)
+        ;
+    return pp;
+}
+
+// uthread_wait() states beyond UW_WAITING and UW_WOKEN: the
+// waiter is switched out, and a waker is filling in the
+// result of one that is or isn't.
+#define UW_PARKED        2
+#define UW_CLAIMED       3
+#define UW_CLAIMEDPARKED 4
+
+// Put blocked thread t on its wait list, or with the thread it
+// joins, or leave it to its waker, or queue it on w again if
+// what it waits for has already happened.
+static void addwaiter(struct worker *w, struct uthread *t)
+{
+    struct uthread *target = t->joining;
+
+    if (t->waitstate)
+    {
+        // a waker that came first leaves it to us to run t.
+        if (!__sync_bool_compare_and_swap(t->waitstate, UW_WAITING, UW_PARKED))
+            enqueue(w, t);
+        return;
+    }
+    if (target)
+    {
+        lock(&idlock);
+        if (target->state == ZOMBIE)
+            enqueue(w, t);
+        else
+            target->joinwait = 1;
+        unlock(&idlock);
+        return;
+    }
+    lock(&waitq.lock);
+    if (t->fd >= 0)
+    {
+        t->prev = 0;
+        if ((t->next = waitq.io) != 0)
+            t->next->prev = t;
+        waitq.io = t;
+    }
+    else
+        timerpush(t);
+    unlock(&waitq.lock);
+}
+
+// Queue on w the threads whose sleep is over at tick now.
+// Returns how many. Caller holds waitq.lock.
+static int waketimers(struct worker *w, uint now)
+{
+    int n = 0;
+
+    while (waitq.ntimers > 0 && waitq.timers[0]->wake <= now)
+    {
+        enqueue(w, timerpop());
+        n++;
+    }
+    return n;
+}
+
+// Queue on w the parked threads that can go on, waiting in
+// poll() for one if block is set and there is none yet (for
+// a tick at most, if other workers might make work). Looks
+// at the threads waiting for files NPOLL at a time, all of
+// them each call, so however many there are, none is passed
+// over; only the last batch waits, and only for a tick if
+// there were others. Returns how many were woken.
+static int poller(struct worker *w, int block)
+{
+    struct pollfd *fds = waitq.fds;
+    struct uthread **ts = waitq.ts, *t;
+    int i, n, woken, timeout, first = 1;
+    uint now;
+
+    if ((waitq.ntimers == 0 && waitq.io == 0) || __sync_lock_test_and_set(&waitq.polling, 1))
+        return 0;
+    now = uptime();
+    lock(&waitq.lock);
+    woken = waketimers(w, now);
+    // only this call takes threads off waitq.io, and others
+    // add them at the head, so t stays on it while unlocked.
+    t = waitq.io;
+    for (;;)
+    {
+        for (n = 0; t && n < NPOLL; t = t->next)
+        {
+            fds[n].fd = t->fd;
+            fds[n].events = t->events;
+            ts[n++] = t;
+        }
+        timeout = 0;
+        if (t == 0 && block && woken == 0)
+        {
+            timeout = waitq.ntimers ? waitq.timers[0]->wake - now : -1;
+            if ((nworkers > 1 || !first) && (timeout < 0 || timeout > 1))
+                timeout = 1;
+        }
+        unlock(&waitq.lock);
+
+        if ((n > 0 || timeout > 0) && poll(fds, n, timeout) > 0)
         {
-            //curr_thread = &threads[i];
+            lock(&waitq.lock);
+            for (i = 0; i < n; i++)
+            {
+                if (fds[i].revents == 0)
+                    continue;
+                if (ts[i]->prev)
+                    ts[i]->prev->next = ts[i]->next;
+                else
+                    waitq.io = ts[i]->next;
+                if (ts[i]->next)
+                    ts[i]->next->prev = ts[i]->prev;
+                enqueue(w, ts[i]);
+                woken++;
+            }
+            unlock(&waitq.lock);
+        }
+        if (t == 0)
             break;
+        first = 0;
+        lock(&waitq.lock);
+    }
+    if (timeout > 0)
+    {
+        now = uptime();
+        lock(&waitq.lock);
+        woken += waketimers(w, now);
+        unlock(&waitq.lock);
+    }
+    __sync_lock_release(&waitq.polling);
+    return woken;
+}
+
+// Free exited thread t, or keep it in the pool.
+static void reap(struct uthread *t)
+{
+    t->state = FREE;
+    lock(&poollock);
+    if (npool < UTHREAD_POOL)
+    {
+        t->next = pool;
+        pool = t;
+        npool++;
+        t = 0;
+    }
+    unlock(&poollock);
+    if (t)
+        free(t);
+}
+
+// Thread t has exited and is switched out: reap it if it is
+// detached, else leave it a ZOMBIE and wake its joiner.
+static void exited(struct worker *w, struct uthread *t)
+{
+    struct uthread **pp;
+
+    lock(&idlock);
+    if (t->detached)
+    {
+        pp = idslot(t->id);
+        *pp = t->hnext;
+        unlock(&idlock);
+        reap(t);
+        return;
+    }
+    t->state = ZOMBIE;
+    if (t->joinwait)
+        enqueue(w, t->joiner);
+    unlock(&idlock);
+}
+
+// Finish the switch to the thread now running: queue the
+// thread switched from if it yielded, park it if it blocked,
+// or see to it if it exited.
+static void finish(void)
+{
+    struct worker *w = myworker();
+    struct uthread *t = w->prev;
+
+    w->prev = 0;
+    if (t == 0 || t->state == RUNNING)
+        return;
+    if (t->state == RUNNABLE)
+        enqueue(w, t);
+    else if (t->state == BLOCKED)
+        addwaiter(w, t);
+    else
+        exited(w, t);
+}
+
+// Switch worker w from thread prev to thread next.
+static void switchto(struct worker *w, struct uthread *prev, struct uthread *next)
+{
+    checkguard(prev);
+    next->state = RUNNING;
+    w->curr = next;
+    w->prev = prev;
+    w->ran = 0;
+    uswtch(&prev->context, &next->context);
+    finish(); // maybe on another worker by now
+}
+
+static void preempt(void *frame);
+
+// Run threads on w until the process exits.
+static void idle(struct worker *w)
+{
+    struct uthread *t;
+    int spins = 0;
+
+    preempt_off(); // for good: idle isn't a thread
+    if (quantum > 0)
+        sigalarm(1, preempt);
+    w->idle.state = RUNNING;
+    w->curr = &w->idle;
+    for (;;)
+    {
+        if ((t = scheduler(w)) != 0)
+        {
+            switchto(w, &w->idle, t);
+            spins = 0;
+        }
+        else if (poller(w, 1) == 0 && ++spins >= IDLESPIN)
+        {
+            sleep(1);
+            spins = 0;
         }
     }
-    if (i == MAX_UTHREADS)
+}
+
+// Each worker kthread but the first starts here, and takes
+// the struct tls uthread_start_all() made for it before
+// anything can call preempt_off(), so that never fails.
+static void worker_main(void)
+{
+    struct worker *w = &workers[__sync_add_and_fetch(&nstarted, 1)];
+
+    settls(w->tls);
+    w->tls->worker = w;
+    idle(w);
+}
+
+// Every thread starts here.
+static void uthread_run(void)
+{
+    finish();
+    preempt_on();
+    uthread_self()->start();
+    uthread_exit();
+}
+
+// A thread with a stack of the current size, from the pool
+// if there is one there, or 0 if out of memory.
+static struct uthread *allocthread(void)
+{
+    struct uthread *t, **pp;
+
+    lock(&poollock);
+    for (pp = &pool; (t = *pp) != 0; pp = &t->next)
     {
-        return -1; // table is full
+        if (t->stacksize == stacksize)
+        {
+            *pp = t->next;
+            npool--;
+            break;
+        }
     }
+    unlock(&poollock);
+    if (t)
+        return t;
+    if ((t = malloc(sizeof(*t) + stacksize)) == 0)
+        return 0;
+    t->ustack = (char *)(t + 1);
+    t->stacksize = stacksize;
+    return t;
+}
+
+// Returns the new thread's id, or -1 if out of memory.
+int uthread_create(void (*start_func)(), enum sched_priority priority)
+{
+    struct uthread *t;
+    struct worker *w;
+    int id;
 
-    threads[i].priority = priority;
-    threads[i].state = RUNNABLE;
-    threads[i].context.ra = (uint64)start_func;
+    preempt_off();
+    if ((t = allocthread()) == 0)
+    {
+        preempt_on();
+        return -1; // out of memory
+    }
+
+    if (growtimers(__sync_add_and_fetch(&num_threads, 1)) < 0)
+    {
+        __sync_fetch_and_sub(&num_threads, 1);
+        reap(t);
+        preempt_on();
+        return -1;
+    }
+    t->priority = priority;
+    t->start = start_func;
+    t->guarded = guard;
+    t->detached = 0;
+    t->joiner = t->joining = 0;
+    t->joinwait = 0;
+    t->waitstate = 0;
+    t->fd = -1;
+    if (guard)
+        memset(t->ustack, GUARD_BYTE, GUARD_SIZE);
     // set thread's context registers
-    threads[i].context.sp = (uint64)&threads[i].ustack + STACK_SIZE;
-    
-    num_threads++;
-    return 0;
+    memset(&t->context, 0, sizeof(t->context));
+    t->context.ra = (uint64)uthread_run;
+    t->context.sp = ((uint64)t->ustack + t->stacksize) & ~15L;
+
+    lock(&idlock);
+    do
+        id = __sync_add_and_fetch(&nextid, 1) & 0x7fffffff;
+    while (id == 0 || *idslot(id) != 0);
+    t->id = id;
+    t->hnext = ids[id % NIDHASH];
+    ids[id % NIDHASH] = t;
+    unlock(&idlock);
+    if ((w = myworker()) == 0)
+        w = &workers[0];
+    enqueue(w, t);
+    preempt_on();
+    return id;
 }
 
-void uthread_yield()
+// Switch w from the running thread, which stays runnable, to
+// the next one, if there is one.
+static void yield(struct worker *w)
 {
-    struct uthread *next_thread = 0;
-    next_thread = scheduler();
+    struct uthread *t = w->curr;
+    struct uthread *next_thread;
+
+    if (++w->npoll >= POLL_EVERY)
+    {
+        w->npoll = 0;
+        poller(w, 0);
+    }
+    next_thread = scheduler(w);
 
     if (next_thread != 0)
     {
-        curr_thread->state = RUNNABLE;
-        struct context *curr_context = &curr_thread->context;
-        struct context *next_context = &next_thread->context;
-        curr_thread = next_thread;
-        curr_thread->state = RUNNING;
-        uswtch(curr_context, next_context);
+        t->state = RUNNABLE;
+        switchto(w, t, next_thread);
     }
 }
 
+void uthread_yield()
+{
+    preempt_off();
+    yield(myworker());
+    preempt_on();
+}
+
+// The sigalarm() upcall, each tick a worker runs user code,
+// on the stack of the thread it interrupted: preempt the
+// thread if it has run for a quantum, unless it was in the
+// library or malloc(). Then, or once the thread runs again,
+// resume it from frame.
+static void preempt(void *frame)
+{
+    struct tls *tp = preempt_off();
+    struct worker *w = tp->worker;
+
+    if (tp->nopreempt == 1 && ++w->ran >= quantum)
+        yield(w);
+    preempt_on();
+    sigreturn(frame);
+}
+
 void uthread_exit()
 {
-    num_threads--;
-    curr_thread->state = FREE;
-    if (num_threads == 0)
+    struct worker *w;
+    struct uthread *t;
+    struct uthread *next_thread;
+
+    preempt_off();
+    w = myworker();
+    t = w->curr;
+    checkguard(t);
+    t->state = FREE; // exited() makes it a ZOMBIE once switched out
+    if (__sync_sub_and_fetch(&num_threads, 1) == 0)
     {
         exit(0);
     }
-    struct uthread *next_thread = 0;
-    next_thread = scheduler();
+    if ((next_thread = scheduler(w)) == 0)
+        next_thread = &w->idle;
+    switchto(w, t, next_thread);
+    fprintf(2, "uthread_exit: exited thread ran\n");
+    exit(1);
+}
 
-    if (next_thread != 0)
+// Block the running thread, which has said what it waits
+// for, until poller() or the thread it joins wakes it.
+static void park(struct worker *w)
+{
+    struct uthread *t = w->curr;
+    struct uthread *next_thread;
+
+    t->state = BLOCKED;
+    if ((next_thread = scheduler(w)) == 0)
+        next_thread = &w->idle;
+    switchto(w, t, next_thread);
+}
+
+// Sleep for n ticks, letting other threads run.
+void uthread_sleep(int n)
+{
+    struct worker *w;
+
+    preempt_off();
+    if ((w = myworker()) == 0)
+    {
+        preempt_on();
+        sleep(n);
+        return;
+    }
+    if (n <= 0)
+        yield(w);
+    else
+    {
+        w->curr->wake = uptime() + n;
+        w->curr->fd = -1;
+        park(w);
+    }
+    preempt_on();
+}
+
+// Wait for thread id to exit, and reap it. Returns -1 if there
+// is no such thread, or it is the caller, detached, or being
+// joined already.
+int uthread_join(int id)
+{
+    struct worker *w;
+    struct uthread *self, *t, **pp;
+
+    preempt_off();
+    w = myworker();
+    self = w ? w->curr : 0;
+    lock(&idlock);
+    t = *idslot(id);
+    if (self == 0 || t == 0 || t == self || t->detached || t->joiner)
+    {
+        unlock(&idlock);
+        preempt_on();
+        return -1;
+    }
+    t->joiner = self;
+    if (t->state != ZOMBIE)
+    {
+        unlock(&idlock);
+        self->joining = t;
+        park(w);
+        self->joining = 0;
+        lock(&idlock);
+    }
+    pp = idslot(id);
+    *pp = t->hnext;
+    unlock(&idlock);
+    reap(t);
+    preempt_on();
+    return 0;
+}
+
+// Have thread id reaped as soon as it exits, or now if it has
+// already. Returns -1 if there is no such thread, or it is
+// detached or being joined already.
+int uthread_detach(int id)
+{
+    struct uthread *t, **pp;
+
+    preempt_off();
+    lock(&idlock);
+    pp = idslot(id);
+    if ((t = *pp) == 0 || t->detached || t->joiner)
+    {
+        unlock(&idlock);
+        preempt_on();
+        return -1;
+    }
+    t->detached = 1;
+    if (t->state == ZOMBIE)
+    {
+        *pp = t->hnext;
+        unlock(&idlock);
+        reap(t);
+    }
+    else
+        unlock(&idlock);
+    preempt_on();
+    return 0;
+}
+
+// Block until a waker sets *state to UW_WOKEN with
+// uthread_wake().
+void uthread_wait(int *state)
+{
+    struct worker *w;
+    struct uthread *t;
+
+    preempt_off();
+    w = myworker();
+    while (*state != UW_WOKEN)
+    {
+        if (w == 0)
+            continue; // not a uthread: spin
+        t = w->curr;
+        t->waitstate = state;
+        park(w);
+        t->waitstate = 0;
+        w = myworker();
+    }
+    __sync_synchronize();
+    preempt_on();
+}
+
+// Claim the thread waiting on *state, to wake it. Returns 0
+// if another waker has already.
+int uthread_claim(int *state)
+{
+    int s;
+
+    for (;;)
+    {
+        s = *state;
+        if (s != UW_WAITING && s != UW_PARKED)
+            return 0;
+        if (__sync_bool_compare_and_swap(state, s, s == UW_PARKED ? UW_CLAIMEDPARKED : UW_CLAIMED))
+            return 1;
+    }
+}
+
+// Wake thread t, claimed waiting on *state, on the caller's
+// worker. *state can go with the waiter as soon as it is set.
+void uthread_wake(int *state, struct uthread *t)
+{
+    struct worker *w;
+    int parked = *state == UW_CLAIMEDPARKED;
+
+    __sync_synchronize();
+    *state = UW_WOKEN;
+    if (parked)
+    {
+        preempt_off();
+        if ((w = myworker()) == 0)
+            w = &workers[0];
+        enqueue(w, t);
+        preempt_on();
+    }
+}
+
+// Park the running thread until I/O on fd for events won't
+// block, or fails.
+static void waitfor(int fd, int events)
+{
+    struct worker *w;
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = events;
+    preempt_off();
+    w = myworker();
+    while (w && poll(&pfd, 1, 0) == 0)
+    {
+        w->curr->fd = fd;
+        w->curr->events = events;
+        park(w);
+        w = myworker();
+    }
+    preempt_on();
+}
+
+// read(), but letting other threads run until there is
+// something to read.
+int uthread_read(int fd, void *buf, int n)
+{
+    waitfor(fd, POLLIN);
+    return read(fd, buf, n);
+}
+
+// write(), but letting other threads run while fd has no
+// room. Writes PIPE_BUF bytes at a time.
+int uthread_write(int fd, const void *buf, int n)
+{
+    int i, m, r;
+
+    for (i = 0; i < n; i += r)
     {
-        struct context *curr_context = &curr_thread->context;
-        struct context *next_context = &next_thread->context;
-        curr_thread = next_thread;
-        uswtch(curr_context, next_context);
+        waitfor(fd, POLLOUT);
+        m = n - i < PIPE_BUF ? n - i : PIPE_BUF;
+        if ((r = write(fd, (char *)buf + i, m)) <= 0)
+            return i > 0 ? i : r;
     }
+    return n;
 }
+
 enum sched_priority uthread_set_priority(enum sched_priority priority)
 {
-    enum sched_priority ret = curr_thread->priority;
-    curr_thread->priority = priority;
+    struct uthread *t = uthread_self();
+    enum sched_priority ret = t->priority;
+    t->priority = priority;
     return ret;
 }
 
 enum sched_priority uthread_get_priority()
 {
-    return curr_thread->priority;
+    return uthread_self()->priority;
+}
+
+// Give threads created from now on stacks of size bytes.
+// Returns the old size.
+uint uthread_set_stacksize(uint size)
+{
+    uint old = stacksize;
+
+    if (size >= 2 * GUARD_SIZE)
+        stacksize = size;
+    return old;
+}
+
+// Guard the stacks of threads created from now on, or don't.
+// Returns the old setting.
+int uthread_set_guard(int on)
+{
+    int old = guard;
+
+    guard = on != 0;
+    return old;
+}
+
+// Preempt a thread once it has run for ticks timer ticks
+// without switching, from uthread_start_all() on; 0 leaves
+// threads to yield. Returns the old quantum, or -1 if ticks
+// is negative or the threads have started.
+int uthread_set_quantum(int ticks)
+{
+    int old = quantum;
+
+    if (started || ticks < 0)
+        return -1;
+    quantum = ticks;
+    return old;
+}
+
+// Have uthread_start_all() run threads on n kthreads.
+// Returns the old number, or -1 if n is out of range or the
+// threads have started.
+int uthread_set_workers(int n)
+{
+    int old = nworkers;
+
+    if (started || n < 1 || n > MAX_WORKERS)
+        return -1;
+    nworkers = n;
+    return old;
 }
 
 int uthread_start_all()
 {
+    struct tls *t;
+    char *stack;
 
     // check if this is the first call to uthread_start_all
     if (num_threads == 0 || started == 1)
@@ -101,50 +951,33 @@ int uthread_start_all()
     }
     started = 1;
 
-    struct uthread *first_thread = 0;
-    first_thread = scheduler();
-    if (first_thread != 0)
+    if ((t = tls()) == 0)
+        return -1;
+    t->worker = &workers[0];
+    workers[0].tls = t;
+    for (int i = 1; i < nworkers; i++)
     {
-        struct context trash;
-        curr_thread = first_thread;
-        curr_thread->state = RUNNING;
-        uswtch(&trash, &curr_thread->context);
+        if ((workers[i].tls = newtls()) == 0 ||
+            (stack = malloc(WORKER_STACK)) == 0 ||
+            kthread_create((void *(*)())worker_main, stack, WORKER_STACK) <= 0)
+        {
+            printf("uthread_start_all: can't start worker %d\n", i);
+            nworkers = i;
+            break;
+        }
     }
-    printf("no thread\n");
+    idle(&workers[0]);
     return -1;
 }
 
 struct uthread *uthread_self()
 {
-    return curr_thread;
-}
-
-struct uthread *scheduler()
-{
-    struct uthread *index;
-    
-    struct uthread *ret = curr_thread;
-    int max_priority = LOW;
-    if(curr_thread == 0) 
-        index = &threads[0];
-    
-    else if (curr_thread == &threads[MAX_UTHREADS - 1])
-        index = &threads[0];
-
-    else
-        index = curr_thread + 1;
-    for (int i = 0; i < MAX_UTHREADS; i++)
-    {
-        if ((index->priority > max_priority && index->state == RUNNABLE) || (max_priority == LOW && index->priority == LOW && index->state == RUNNABLE))
-        {
-            ret = index;
-            max_priority = index->priority;
-        }
+    struct worker *w;
+    struct uthread *t;
 
-        if (index == &threads[MAX_UTHREADS - 1])
-            index = &threads[0];
-        else
-            index++;
-    }
-    return ret;
-}
\ No newline at end of file
+    preempt_off();
+    w = myworker();
+    t = w ? w->curr : 0;
+    preempt_on();
+    return t;
+}
@@ -1,10 +1,15 @@
-#define STACK_SIZE  4000
-#define MAX_UTHREADS  4
+#define STACK_SIZE  4000     // default uthread stack size
+#define UTHREAD_POOL  64     // exited uthreads kept for reuse
+#define GUARD_SIZE  64       // bytes checked at the bottom of a guarded stack
+#define MAX_WORKERS  8       // kthreads uthreads can run on
+#define WORKER_STACK  8192   // stack size of a worker kthread
+#define POLL_EVERY  64       // yields between looks for threads to wake
+#define NIDHASH  512         // buckets in the table of thread ids
 
 enum sched_priority { LOW, MEDIUM, HIGH };
 
 /* Possible states of a thread: */
-enum tstate { FREE, RUNNING, RUNNABLE };
+enum tstate { FREE, RUNNING, RUNNABLE, BLOCKED, ZOMBIE };
 
 // Saved registers for context switches.
 struct context {
@@ -26,11 +31,28 @@ struct context {
     uint64 s11;
 };
 
+// A uthread and its stack are allocated together, and kept
+// in a pool for reuse after the thread exits and is joined,
+// or at once if it was detached.
 struct uthread {
-    char                ustack[STACK_SIZE];  // the thread's stack
-    enum tstate         state;          // FREE, RUNNING, RUNNABLE
+    char                *ustack;        // the thread's stack
+    uint                stacksize;      // and its size
+    int                 guarded;        // check ustack for overflow
+    enum tstate         state;          // FREE, RUNNING, RUNNABLE, ...
+    int                 id;             // uthread_create()'s result
+    int                 detached;       // reap it when it exits
+    struct uthread      *joiner;        // the thread joining it, or 0
+    int                 joinwait;       // and that one is parked
+    struct uthread      *joining;       // BLOCKED: in uthread_join() of this,
+    int                 *waitstate;     // or in uthread_wait() on this,
     struct context      context;        // uswtch() here to run process
     enum sched_priority priority;       // scheduling priority
+    void                (*start)();     // the function it runs
+    uint                wake;           // or tick to wake at,
+    int                 fd;             // or file to wait for (if >= 0)
+    short               events;         // to be ready for these poll() events
+    struct uthread      *next, *prev;   // in a run queue, a wait list, or the pool
+    struct uthread      *hnext;         // in the table of ids
 };
 
 extern void uswtch(struct context*, struct context*);
@@ -39,6 +61,8 @@ int uthread_create(void (*start_func)(), enum sched_priority priority);
 
 void uthread_yield();
 void uthread_exit();
+int uthread_join(int id);
+int uthread_detach(int id);
 
 int uthread_start_all();
 enum sched_priority uthread_set_priority(enum sched_priority priority);
@@ -46,4 +70,102 @@ enum sched_priority uthread_get_priority();
 
 struct uthread* uthread_self();
 
-struct uthread* scheduler();
+uint uthread_set_stacksize(uint size);
+int uthread_set_guard(int on);
+int uthread_set_workers(int n);
+int uthread_set_quantum(int ticks);
+
+void uthread_sleep(int ticks);
+int uthread_read(int fd, void *buf, int n);
+int uthread_write(int fd, const void *buf, int n);
+
+// For code that blocks threads, like usync.c: a thread puts a
+// wait state, UW_WAITING, where wakers will find it, and calls
+// uthread_wait(). A waker that wins uthread_claim() on it
+// fills in the result and calls uthread_wake().
+#define UW_WAITING 0
+#define UW_WOKEN   1
+
+void uthread_wait(int *state);
+int uthread_claim(int *state);
+void uthread_wake(int *state, struct uthread *t);
+
+// usync.c
+struct uwaiter;
+
+struct uwaitq {
+    struct uwaiter *head, *tail;
+};
+
+struct umutex {
+    int lock;
+    int locked;
+    struct uwaitq q;
+};
+
+struct ucond {
+    int lock;
+    struct uwaitq q;
+};
+
+struct usem {
+    int lock;
+    int count;
+    struct uwaitq q;
+};
+
+struct uchan {
+    int lock;
+    void **buf;            // cap values, from head on
+    int cap, n, head;
+    int closed;
+    struct uwaitq sendq, recvq;
+};
+
+#define USEND 0
+#define URECV 1
+#define NSELECT 16         // most cases in a uchan_select()
+
+struct uselect {
+    struct uchan *chan;
+    int op;                // USEND or URECV
+    void *val;             // to send, or received
+    int ok;                // 0 if the channel was closed
+};
+
+void umutex_init(struct umutex *m);
+void umutex_lock(struct umutex *m);
+int umutex_trylock(struct umutex *m);
+void umutex_unlock(struct umutex *m);
+void ucond_init(struct ucond *c);
+void ucond_wait(struct ucond *c, struct umutex *m);
+void ucond_signal(struct ucond *c);
+void ucond_broadcast(struct ucond *c);
+void usem_init(struct usem *s, int count);
+void usem_down(struct usem *s);
+void usem_up(struct usem *s);
+struct uchan *uchan_new(int cap);
+void uchan_free(struct uchan *c);
+int uchan_send(struct uchan *c, void *val);
+int uchan_recv(struct uchan *c, void **val);
+void uchan_close(struct uchan *c);
+int uchan_select(struct uselect *cases, int n, int block);
+
+// coro.c
+#define CORO_STACK 2048    // default coroutine stack size
+
+struct coro {
+    struct context context;   // registers while suspended
+    struct context back;      // of whoever resumed it
+    void *(*fn)(struct coro *self, void *val);
+    void *val;                // passed by the last switch
+    int running;              // resumed and not yet yielded
+    int done;                 // fn has returned
+    uint64 *canary;           // at the bottom of its stack
+};
+
+struct coro *coro_create(void *(*fn)(struct coro *self, void *val), uint stacksize);
+void *coro_resume(struct coro *c, void *val);
+void *coro_yield_value(struct coro *self, void *val);
+int coro_done(struct coro *c);
+void coro_free(struct coro *c);
@@ -11,8 +11,7 @@ void f1()
     for(;;)
     {
         printf("i = %d\n", i);
-        sleep(5);
-        uthread_yield();
+        uthread_sleep(5);
         i++;
         if(i == 5)
         {
@@ -30,8 +29,7 @@ void f2()
     for(;;)
     {
         printf("j = %d\n", j);
-        sleep(5);
-        uthread_yield();
+        uthread_sleep(5);
         j++;
         if(j == 5)
         {
@@ -48,6 +46,7 @@ int main()
     uthread_create(f2, LOW);
     uthread_create(f1, HIGH);
     //uthread_create(f2, MEDIUM);
+    uthread_set_quantum(5);
     uthread_start_all();
     exit(0);
 }
\ No newline at end of file
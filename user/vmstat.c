@@ -0,0 +1,53 @@
+// Print the kernel's virtual memory counters.
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/vmstat.h"
+#include "user/user.h"
+
+// print the average of n timings of total timer cycles, in
+// microseconds, with qemu's 10 MHz timer.
+void
+usecs(char *what, uint64 total, uint64 n)
+{
+  uint64 t = n ? total / n : 0;
+
+  printf("%s %d.%d us\n", what, (int)(t / 10), (int)(t % 10));
+}
+
+int
+main(void)
+{
+  struct vmstat st;
+
+  if(vmstat(&st) < 0){
+    fprintf(2, "vmstat: failed\n");
+    exit(1);
+  }
+  printf("lazy heap pages reserved   %d\n", (int)st.lazy_pages);
+  printf("zero page read mappings    %d\n", (int)st.zero_maps);
+  printf("pages allocated on write   %d\n", (int)st.lazy_allocs);
+  printf("allocations avoided        %d\n", (int)(st.lazy_pages - st.lazy_allocs));
+  printf("exec pages left unloaded   %d\n", (int)st.exec_pages);
+  printf("exec pages faulted in      %d\n", (int)st.exec_loads);
+  printf("heap superpages mapped     %d\n", (int)st.super_allocs);
+  printf("superpages split           %d\n", (int)st.super_demotes);
+  printf("same-mm kthread switches   %d\n", (int)st.samemm_switches);
+  printf("kthread migrations         %d\n", (int)st.migrations);
+  printf("pages scanned for reclaim  %d\n", (int)st.reclaim_scanned);
+  printf("recently used, spared      %d\n", (int)st.reclaim_referenced);
+  printf("pages swapped out          %d\n", (int)st.swap_outs);
+  printf("pages swapped in           %d\n", (int)st.swap_ins);
+  printf("swap slots used            %d of %d\n", (int)st.swap_used, (int)st.swap_slots);
+  printf("swap-outs kept in RAM      %d (%d one word repeated)\n",
+         (int)st.zram_stores, (int)st.zram_same);
+  printf("swap-outs sent to disk     %d\n", (int)(st.swap_outs - st.zram_stores));
+  printf("compressed pages in RAM    %d in %d KB (%d%%), %d pool pages\n",
+         (int)st.zram_pages, (int)(st.zram_bytes / 1024),
+         st.zram_pages ? (int)(st.zram_bytes * 100 / (st.zram_pages * PGSIZE)) : 0,
+         (int)st.zram_pool);
+  usecs("avg swap-in from RAM      ", st.zram_in_time, st.zram_loads);
+  usecs("avg swap-in from disk     ", st.disk_in_time, st.swap_ins - st.zram_loads);
+  printf("address spaces reaped      %d\n", (int)st.reaped);
+  exit(0);
+}
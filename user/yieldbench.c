@@ -0,0 +1,66 @@
+// Measure uthread_yield() throughput with 4, 64 and 1024
+// uthreads, run by 1, 2 and 4 worker kthreads.
+//
+// usage: yieldbench [yields]
+//
+// each run happens in a child, since the last uthread to
+// exit ends the process; the threads share the yields out
+// evenly and the last one to finish reports the time.
+
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/uthread.h"
+
+int nyields = 200000;
+int nthreads, nworkers, each, done, t0;
+
+void
+worker(void)
+{
+  int i;
+
+  for(i = 0; i < each; i++)
+    uthread_yield();
+  if(__sync_add_and_fetch(&done, 1) == nthreads)
+    printf("%d uthreads, %d workers: %d yields in %d ticks\n", nthreads,
+           nworkers, each * nthreads, uptime() - t0);
+  uthread_exit();
+}
+
+int
+run(int n, int workers)
+{
+  int i, xstatus;
+
+  if(fork() == 0){
+    nthreads = n;
+    nworkers = workers;
+    uthread_set_workers(workers);
+    each = nyields / n;
+    for(i = 0; i < n; i++){
+      if(uthread_create(worker, MEDIUM) < 0){
+        fprintf(2, "yieldbench: uthread_create failed\n");
+        exit(1);
+      }
+    }
+    t0 = uptime();
+    uthread_start_all();
+    exit(1);
+  }
+  wait(&xstatus);
+  return xstatus;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, w;
+
+  if(argc > 1)
+    nyields = atoi(argv[1]);
+  for(w = 1; w <= 4; w *= 2)
+    for(n = 4; n <= 1024; n *= 16)
+      if(run(n, w) != 0)
+        exit(1);
+  exit(0);
+}